@@ -1,13 +1,18 @@
 #include "uos.h"
 
 int main(int argc,char** argv){
-	OS_INFO info[2];
-	dword len = sizeof(info);
+	qword buffer[0x80];
+	auto info = (OS_INFO*)buffer;
+	dword len = sizeof(buffer);
 	if (SUCCESS != os_info(info,&len))
 		return -1;
+	auto core_info = (const CORE_INFO*)(info + 1);
+	auto description = (const char*)(core_info + info->core_info);
+	if (info->core_info == 0)
+		description = "";
 
 	printf("%s\nversion %x\nactive core %hu\nfeatures 0x%hx\nresolution %d*%d\n",\
-		info + 1, info->version, info->active_core, \
+		description, info->version, info->active_core, \
 		info->features, info->resolution_x, info->resolution_y
 	);
 
@@ -29,5 +34,6 @@ int main(int argc,char** argv){
 		info->total_memory/total_divider, total_unit, \
 		hour,min,sec,ms
 	);
+	printf("cpu_load %u.%u%%\n",info->cpu_load/10,info->cpu_load%10);
 	return 0;
 }
\ No newline at end of file
@@ -10,6 +10,7 @@ STATUS		osctl(osctl_code cmd,void* buffer,dword* length);
 STATUS		os_info(OS_INFO* buffer,dword* length);
 qword		get_time(void);
 STATUS		enum_process(dword* id);
+qword		get_clock(void);
 STATUS		display_fill(dword color,const rectangle* rect);
 STATUS		display_draw(const dword* buffer,const rectangle* rect,word advance);
 HANDLE		get_thread(void);
@@ -31,19 +32,24 @@ STATUS		get_command(HANDLE handle,char* buffer,dword* length);
 void		exit_process(dword result);
 STATUS		kill_process(HANDLE handle,dword result);
 STATUS		process_result(HANDLE handle,dword* result);
+STATUS		set_share(HANDLE handle,dword share);
 STATUS		create_process(const STARTUP_INFO* info,dword length,HANDLE* handle);
 STATUS		open_process(dword id,HANDLE* handle);
+STATUS		clone_process(void (*func)(void*,void*),void* arg,HANDLE* handle);
 STATUS		get_work_dir(char* buffer,dword* length);
 STATUS		set_work_dir(const char* path,dword length);
 OBJTYPE		handle_type(HANDLE handle);
 STATUS		open_handle(const char* name,dword length,HANDLE* handle);
 STATUS		close_handle(HANDLE handle);
 STATUS		create_object(OBJTYPE type,qword a1,qword a2,HANDLE* handle);
+STATUS		name_object(HANDLE handle,const char* name,dword length);
 qword		vm_peek(void* va);
 STATUS		vm_protect(void* base,dword count,qword attrib);
 void*		vm_reserve(void* base,dword count);
 STATUS		vm_commit(void* base,dword count);
 STATUS		vm_release(void* base,dword count);
+void*		vm_map(HANDLE section,void* base,dword count);
+STATUS		vm_sync(void* base,dword count);
 dword		stream_state(HANDLE handle,dword* count);
 dword		stream_read(HANDLE handle,void* buffer,dword* length);
 dword		stream_write(HANDLE handle,const void* buffer,dword* length);
@@ -55,6 +61,7 @@ STATUS		file_path(HANDLE handle,char* buffer,dword* length);
 STATUS		file_info(HANDLE handle,const FILE_INFO* buffer,dword* length);
 STATUS		file_change(HANDLE handle,dword attrib);
 STATUS		file_move(HANDLE handle,const char* target,dword length);
+void*		file_map(HANDLE handle,void* base,dword count);
 
 #ifdef __cplusplus
 }
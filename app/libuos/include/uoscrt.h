@@ -84,6 +84,9 @@ int fgetc(FILE* stream);
 
 int ungetc(int ch,FILE* stream);
 
+//timestamp counter, not serialized
+qword rdtsc(void);
+
 #ifdef __cplusplus
 }
 
@@ -11,6 +11,17 @@ inline S unpack_qword(qword val,T* res){
 	*res = (T)(val >> 32);
 	return (S)(dword)val;
 }
+static inline qword read_tsc(void){
+	dword lo,hi;
+	__asm__ volatile (
+		"rdtsc"
+		: "=a" (lo), "=d" (hi)
+	);
+	return ((qword)hi << 32) | lo;
+}
+
+static TIME_PAGE const volatile* const time_page = (TIME_PAGE const volatile*)TIME_PAGE_BASE;
+
 inline qword pack_rect(const rectangle& rect){ 
 	dword lt = ((dword)rect.top << 16) | rect.left;
 	dword rb = ((dword)rect.bottom << 16) | rect.right;
@@ -27,12 +38,31 @@ STATUS os_info(OS_INFO* buffer,dword* length) {
 	return unpack_qword(res,length);
 }
 qword get_time(void) {
-	return syscall(srv::get_time);
+	qword time = time_page->wall_time;
+	//RTC not updated yet
+	return time ? time : syscall(srv::get_time);
 }
 STATUS enum_process(dword* id) {
 	auto res = syscall(srv::enum_process,*id);
 	return unpack_qword(res,id);
 }
+qword get_clock(void) {
+	qword ns,tsc_base,mul;
+	dword seq;
+	do{
+		seq = time_page->sequence;
+		ns = time_page->clock_ns;
+		tsc_base = time_page->tsc_base;
+		mul = time_page->tsc_mul;
+	}while((seq & 1) || seq != time_page->sequence);
+	if (mul == 0)
+		return syscall(srv::get_clock);
+	qword delta = read_tsc() - tsc_base;
+	//TSC of this core slightly behind
+	if (delta >> 63)
+		delta = 0;
+	return ns + (delta >> 32)*mul + (((delta & 0xFFFFFFFF)*mul) >> 32);
+}
 STATUS display_fill(dword color,const rectangle* rect) {
 	return (STATUS)syscall(srv::display_fill,color,pack_rect(*rect));
 }
@@ -100,6 +130,9 @@ STATUS process_result(HANDLE handle,dword* result) {
 	auto res = syscall(srv::process_result,handle);
 	return unpack_qword(res,result);
 }
+STATUS set_share(HANDLE handle,dword share) {
+	return (STATUS)syscall(srv::set_share,handle,share);
+}
 STATUS create_process(const STARTUP_INFO* info,dword length,HANDLE* handle) {
 	auto res = syscall(srv::create_process,info,length);
 	return unpack_qword(res,handle);
@@ -108,6 +141,10 @@ STATUS open_process(dword id,HANDLE* handle) {
 	auto res = syscall(srv::open_process,id);
 	return unpack_qword(res,handle);
 }
+STATUS clone_process(void (*func)(void*,void*),void* arg,HANDLE* handle) {
+	auto res = syscall(srv::clone_process,func,arg);
+	return unpack_qword(res,handle);
+}
 STATUS get_work_dir(char* buffer,dword* length){
 	auto res = syscall(srv::get_work_dir,buffer,*length);
 	return unpack_qword(res,length);
@@ -129,6 +166,9 @@ STATUS create_object(OBJTYPE type,qword a1,qword a2,HANDLE* handle){
 	auto res = syscall(srv::create_object,type,a1,a2);
 	return unpack_qword(res,handle);
 }
+STATUS name_object(HANDLE handle,const char* name,dword length){
+	return (STATUS)syscall(srv::name_object,handle,name,length);
+}
 qword vm_peek(void* va) {
 	return syscall(srv::vm_peek,va);
 }
@@ -144,6 +184,12 @@ STATUS vm_commit(void* base,dword count) {
 STATUS vm_release(void* base,dword count) {
 	return (STATUS)syscall(srv::vm_release,base,count);
 }
+void* vm_map(HANDLE section,void* base,dword count) {
+	return (void*)syscall(srv::vm_map,section,base,count);
+}
+STATUS vm_sync(void* base,dword count) {
+	return (STATUS)syscall(srv::vm_sync,base,count);
+}
 dword stream_state(HANDLE handle,dword* count){
 	auto res = syscall(srv::stream_state,handle);
 	return unpack_qword<dword,dword>(res,count);
@@ -182,4 +228,7 @@ STATUS file_change(HANDLE handle,dword attrib){
 }
 STATUS file_move(HANDLE handle,const char* target,dword length){
 	return (STATUS)syscall(srv::file_move,handle,target,length);
+}
+void* file_map(HANDLE handle,void* base,dword count){
+	return (void*)syscall(srv::file_map,handle,base,count);
 }
\ No newline at end of file
@@ -623,7 +623,7 @@ void exit(int result){
 
 qword rdtsc(void){
 	dword lo,hi;
-	__asm__ (
+	__asm__ volatile (
 		"rdtsc"
 		: "=a" (lo), "=d" (hi)
 	);
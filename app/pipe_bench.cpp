@@ -0,0 +1,128 @@
+#include "uos.h"
+
+//moves 'length' bytes over 'handle', waits when pipe full or empty
+static bool transfer(HANDLE handle,byte* buffer,dword length,bool write){
+	dword count = 0;
+	while(count < length){
+		dword size = length - count;
+		auto res = write ? stream_write(handle,buffer + count,&size) : stream_read(handle,buffer + count,&size);
+		if (res != SUCCESS)
+			return false;
+		count += size;
+		if (size)
+			continue;
+		switch(wait_for(handle,0,0)){
+			case PASSED:
+			case NOTIFY:
+				break;
+			default:
+				return false;
+		}
+	}
+	return true;
+}
+
+//child side, echoes stdin to stdout until killed
+static int echo(void){
+	byte buffer[0x100];
+	while(true){
+		dword size = sizeof(buffer);
+		if (SUCCESS != stream_read(STDIN,buffer,&size))
+			return 2;
+		if (size == 0){
+			switch(wait_for(STDIN,0,0)){
+				case PASSED:
+				case NOTIFY:
+					continue;
+				default:
+					return 2;
+			}
+		}
+		if (!transfer(STDOUT,buffer,size,true))
+			return 2;
+	}
+}
+
+//every round trip switches to the other process and back, see this_core::switch_space
+int main(int argc,char** argv){
+	dword length = 8;
+	dword rounds = 0x1000;
+	if (argc > 1){
+		if (0 == strcmp(argv[1],"--help")){
+			printf("%s [length] [rounds]\tMeasure cycles per round trip between two processes over pipe\n",argv[0]);
+			return 1;
+		}
+		if (0 == strcmp(argv[1],"--echo"))
+			return echo();
+		length = strtoul(argv[1],nullptr,0);
+	}
+	if (argc > 2)
+		rounds = strtoul(argv[2],nullptr,0);
+	if (length == 0 || length > 0x100 || rounds == 0){
+		fputs("bad parameter\n",stderr);
+		return 1;
+	}
+
+	HANDLE to_child = 0;
+	HANDLE to_parent = 0;
+	if (SUCCESS != create_object(OBJ_PIPE,0x200,1,&to_child) || SUCCESS != create_object(OBJ_PIPE,0x200,0,&to_parent)){
+		fputs("failed to create pipe\n",stderr);
+		return 2;
+	}
+	char command[0x100];
+	auto cmd_length = strlen(argv[0]);
+	if (cmd_length + 8 > sizeof(command)){
+		fputs("bad parameter\n",stderr);
+		return 1;
+	}
+	memcpy(command,argv[0],cmd_length);
+	memcpy(command + cmd_length," --echo",8);
+	char work_dir[0x100];
+	dword wd_length = sizeof(work_dir);
+	if (SUCCESS != get_work_dir(work_dir,&wd_length)){
+		fputs("failed to get work dir\n",stderr);
+		return 2;
+	}
+	STARTUP_INFO info = {0};
+	info.commandline = command;
+	info.cmd_length = cmd_length + 7;
+	info.work_dir = work_dir;
+	info.wd_length = wd_length;
+	info.flags = NORMAL;
+	info.std_handle[0] = to_child;
+	info.std_handle[1] = to_parent;
+	info.std_handle[2] = STDERR;
+	HANDLE child = 0;
+	if (SUCCESS != create_process(&info,sizeof(STARTUP_INFO),&child)){
+		fputs("failed to create process\n",stderr);
+		return 2;
+	}
+
+	byte buffer[0x100];
+	for (dword i = 0;i < length;++i)
+		buffer[i] = (byte)i;
+	int result = 0;
+	auto time_begin = get_clock();
+	auto tsc_begin = rdtsc();
+	for (dword r = 0;r < rounds;++r){
+		if (!transfer(to_child,buffer,length,true) || !transfer(to_parent,buffer,length,false)){
+			fputs("pipe broken\n",stderr);
+			result = 2;
+			break;
+		}
+	}
+	auto tsc_end = rdtsc();
+	auto time_end = get_clock();
+
+	kill_process(child,0);
+	close_handle(child);
+	close_handle(to_child);
+	close_handle(to_parent);
+	if (result)
+		return result;
+
+	printf("%u bytes per message, %u rounds\n",length,rounds);
+	printf("%u round trips in %llu us\n",rounds,(time_end - time_begin)/1000);
+	printf("%llu cycles per round trip\n",(tsc_end - tsc_begin)/rounds);
+	return 0;
+}
@@ -0,0 +1,58 @@
+#include "uos.h"
+
+//vm_commit is lazy, the write fault on each page goes through PM::allocate
+//vm_release of touched pages goes through PM::release
+int main(int argc,char** argv){
+	dword batch = 0x1000;
+	dword rounds = 0x400;
+	if (argc > 1){
+		if (0 == strcmp(argv[1],"--help")){
+			printf("%s [batch] [rounds]\tMeasure cycles per page with commit/touch/release of page batches\n",argv[0]);
+			return 1;
+		}
+		batch = strtoul(argv[1],nullptr,0);
+	}
+	if (argc > 2)
+		rounds = strtoul(argv[2],nullptr,0);
+	if (batch == 0 || batch > 0x40000 || rounds == 0){
+		fputs("bad parameter\n",stderr);
+		return 1;
+	}
+
+	auto base = (byte*)vm_reserve(nullptr,batch);
+	if (base == nullptr){
+		fputs("failed to reserve memory\n",stderr);
+		return 2;
+	}
+	qword page_count = 0;
+	auto time_begin = get_clock();
+	auto tsc_begin = rdtsc();
+	for (dword r = 0;r < rounds;++r){
+		for (dword i = 0;i < batch;++i){
+			if (SUCCESS != vm_commit(base + (qword)i*PAGE_SIZE,1)){
+				fputs("failed to commit memory\n",stderr);
+				return 2;
+			}
+			//fault in the frame
+			*(volatile byte*)(base + (qword)i*PAGE_SIZE) = (byte)i;
+		}
+		page_count += batch;
+		if (SUCCESS != vm_release(base,batch)){
+			fputs("failed to release memory\n",stderr);
+			return 2;
+		}
+		base = (byte*)vm_reserve(nullptr,batch);
+		if (base == nullptr){
+			fputs("failed to reserve memory\n",stderr);
+			return 2;
+		}
+	}
+	auto tsc_end = rdtsc();
+	auto time_end = get_clock();
+	vm_release(base,batch);
+
+	printf("%u pages per batch, %u rounds\n",batch,rounds);
+	printf("%llu pages in %llu us\n",page_count,(time_end - time_begin)/1000);
+	printf("%llu cycles per page\n",(tsc_end - tsc_begin)/page_count);
+	return 0;
+}
@@ -0,0 +1,85 @@
+#include "uos.h"
+
+static volatile dword ready_count = 0;
+static volatile bool start = false;
+
+//each sleep(0) goes through core_manager::preempt
+static void thread_yield(void* rounds,void*){
+	__atomic_add_fetch(&ready_count,1,__ATOMIC_SEQ_CST);
+	while(!start)
+		sleep(0);
+	for (auto i = (qword)rounds;i;--i)
+		sleep(0);
+	exit_thread();
+}
+
+//keeps lower priority levels populated
+static void thread_spin(void*,void*){
+	while(true);
+}
+
+int main(int argc,char** argv){
+	dword thread_count = 4;
+	qword rounds = 0x1000;
+	dword spin_count = 0;
+	if (argc > 1){
+		if (0 == strcmp(argv[1],"--help")){
+			printf("%s [threads] [rounds] [spin]\tMeasure cycles per preempt with yielding threads\n",argv[0]);
+			return 1;
+		}
+		thread_count = strtoul(argv[1],nullptr,0);
+	}
+	if (argc > 2)
+		rounds = strtoull(argv[2],nullptr,0);
+	if (argc > 3)
+		spin_count = strtoul(argv[3],nullptr,0);
+	if (thread_count == 0 || thread_count > 0x40 || rounds == 0 || spin_count > 0x10){
+		fputs("bad parameter\n",stderr);
+		return 1;
+	}
+
+	HANDLE self = get_thread();
+	auto priority = get_priority(self);
+	close_handle(self);
+
+	HANDLE spin_list[0x10];
+	for (dword i = 0;i < spin_count;++i){
+		if (SUCCESS != create_thread(thread_spin,nullptr,PAGE_SIZE,spin_list + i)){
+			fputs("failed to create thread\n",stderr);
+			return 2;
+		}
+		set_priority(spin_list[i],priority + 1 + i % 4);
+	}
+	HANDLE list[0x40];
+	for (dword i = 0;i < thread_count;++i){
+		if (SUCCESS != create_thread(thread_yield,(void*)rounds,PAGE_SIZE,list + i)){
+			fputs("failed to create thread\n",stderr);
+			return 2;
+		}
+	}
+	while(ready_count != thread_count)
+		sleep(0);
+
+	//monotonic clock in ns, see basic_timer::clock_ns
+	auto time_begin = get_clock();
+	auto tsc_begin = rdtsc();
+	start = true;
+	for (dword i = 0;i < thread_count;++i){
+		wait_for(list[i],0,0);
+		close_handle(list[i]);
+	}
+	auto tsc_end = rdtsc();
+	auto time_end = get_clock();
+
+	for (dword i = 0;i < spin_count;++i){
+		kill_thread(spin_list[i]);
+		close_handle(spin_list[i]);
+	}
+
+	qword total = thread_count*rounds;
+	printf("%u threads, %llu rounds, %u spinning\n",thread_count,rounds,spin_count);
+	printf("%llu preempts in %llu us\n",total,(time_end - time_begin)/1000);
+	printf("%llu ns per preempt\n",(time_end - time_begin)/total);
+	printf("%llu cycles per preempt\n",(tsc_end - tsc_begin)/total);
+	return 0;
+}
@@ -0,0 +1,133 @@
+#include "uos.h"
+#include "util.hpp"
+
+using namespace UOS;
+
+static constexpr dword max_process = 0x40;
+static constexpr dword max_core = 0x20;
+
+struct process_sample{
+	dword id;
+	qword cpu_time;
+	SCHED_STAT sched;
+};
+
+struct sample{
+	qword clock;
+	dword process_count;
+	dword core_count;
+	process_sample ps[max_process];
+	CORE_INFO core[max_core];
+};
+
+//too large for stack
+static sample sample_list[2];
+
+static bool take_sample(sample& s){
+	static qword buffer[0x200];
+	auto info = (OS_INFO*)buffer;
+	dword len = sizeof(buffer);
+	if (SUCCESS != os_info(info,&len) || info->core_info == 0)
+		return false;
+	s.clock = get_clock();
+	s.core_count = min<dword>(info->core_info,max_core);
+	memcpy(s.core,info + 1,s.core_count*sizeof(CORE_INFO));
+
+	s.process_count = 0;
+	dword pid = 0;
+	do{
+		if (SUCCESS != enum_process(&pid))
+			return false;
+		HANDLE hps = 0;
+		if (SUCCESS != open_process(pid,&hps))
+			continue;
+		PROCESS_INFO ps_info;
+		dword size = sizeof(ps_info);
+		if (SUCCESS == process_info(hps,&ps_info,&size) && size == sizeof(ps_info) && s.process_count < max_process){
+			auto& cur = s.ps[s.process_count++];
+			cur.id = pid;
+			cur.cpu_time = ps_info.cpu_time;
+			cur.sched = ps_info.sched;
+		}
+		close_handle(hps);
+	}while(pid);
+	return true;
+}
+
+static void print_stat(const SCHED_STAT& cur,const SCHED_STAT* prev){
+	SCHED_STAT zero = {};
+	if (prev == nullptr)
+		prev = &zero;
+	printf("%8llu %8llu %6llu %6llu %8llu\n",\
+		cur.switch_count - prev->switch_count,\
+		cur.preempt_count - prev->preempt_count,\
+		cur.slice_count - prev->slice_count,\
+		cur.fpu_trap - prev->fpu_trap,\
+		(cur.wait_time - prev->wait_time)/1000);
+}
+
+static void report(const sample& cur,const sample& prev){
+	qword elapsed_us = max<qword>((cur.clock - prev.clock)/1000,1);
+	printf("core  load%%  idle_ms  busy_ms   switch  preempt  slice    fpu  wait_ms\n");
+	for (dword i = 0;i < cur.core_count && i < prev.core_count;++i){
+		auto& c = cur.core[i];
+		auto& p = prev.core[i];
+		qword idle = c.idle_time - p.idle_time;
+		qword busy = c.busy_time - p.busy_time;
+		qword load = (idle + busy) ? busy*1000/(idle + busy) : 0;
+		printf("%4hu %3llu.%llu %8llu %8llu ",c.uid,load/10,load%10,idle/1000,busy/1000);
+		print_stat(c.sched,&p.sched);
+	}
+	printf("\n pid   cpu%%   switch  preempt  slice    fpu  wait_ms\n");
+	for (dword i = 0;i < cur.process_count;++i){
+		auto& c = cur.ps[i];
+		const process_sample* p = nullptr;
+		for (dword j = 0;j < prev.process_count;++j){
+			if (prev.ps[j].id == c.id){
+				p = prev.ps + j;
+				break;
+			}
+		}
+		qword cpu = c.cpu_time - (p ? p->cpu_time : 0);
+		cpu = cpu*1000/elapsed_us;
+		printf("%4u %4llu.%llu ",c.id,cpu/10,cpu%10);
+		print_stat(c.sched,p ? &p->sched : nullptr);
+	}
+}
+
+int main(int argc,char** argv){
+	dword interval = 1000;
+	dword rounds = 1;
+	if (argc > 1){
+		if (0 == strcmp(argv[1],"--help")){
+			printf("%s [interval_ms] [rounds]\tShow per-core and per-process scheduling statistics\n",argv[0]);
+			return 1;
+		}
+		interval = strtoul(argv[1],nullptr,0);
+	}
+	if (argc > 2)
+		rounds = strtoul(argv[2],nullptr,0);
+	if (interval == 0 || rounds == 0){
+		fputs("bad parameter\n",stderr);
+		return 1;
+	}
+	unsigned index = 0;
+	if (!take_sample(sample_list[index])){
+		fputs("failed to get system info\n",stderr);
+		return 3;
+	}
+	while(rounds--){
+		sleep((qword)interval*1000);
+		auto& prev = sample_list[index];
+		index ^= 1;
+		auto& cur = sample_list[index];
+		if (!take_sample(cur)){
+			fputs("failed to get system info\n",stderr);
+			return 3;
+		}
+		report(cur,prev);
+		if (rounds)
+			printf("\n");
+	}
+	return 0;
+}
@@ -141,6 +141,6 @@ void krnlentry(void* module_base){
 
 	//as idle thread
 	while(true){
-		hlt();
+		cores.idle();
 	}
 }
\ No newline at end of file
@@ -46,67 +46,18 @@ APIC::APIC(void) : table{0}{
 		bugcheck("ACPI base mismatch (%p,%p)",madt->local_apic_pbase,base);
 	}
 
-	if (stat & 0x400){
-		//x2APIC, reset
-		stat &= (~0xC00);
-		wrmsr(MSR_APIC_BASE,stat);
+	if (0 == (stat & 0x100)){	//not BSP
+		bugcheck("APIC constructed on AP");
 	}
-	wrmsr(MSR_APIC_BASE,stat | 0x800);
 
 	//maps local APIC
 	auto res = vm.assign(LOCAL_APIC_VBASE,base,1);
 	if (!res)
 		bugcheck("vm.assign failed @ %p",base);
 
-	auto svr = apic_read(0xF0);
-	apic_write(0xF0,svr | 0x100);    //APIC enable
-
-	res = false;
+	setup_local();
 	byte apic_id = id();
-	byte uid = 0;
-	for (auto& p : madt->processors){
-		if (p.apic_id == apic_id){
-			uid = p.uid;
-			res = true;
-			break;
-		}
-	}
-	if (!res)
-		bugcheck("APIC id#%x not found",apic_id);
-	dbgprint("CPU#%d APICid#%d %s",uid,apic_id,(stat & 0x100) ? "BSP" : "AP");
-	
-	//local APIC setup
-	
-	apic_write(0x2F0,0x00010000); //CMCI
-	apic_write(0x320,(dword)IRQ_APIC_TIMER);  //timer
-	apic_write(0x330,0x00010000);    //Thermal Monitor
-	apic_write(0x340,0x00010000);    //Perf Counter
-	apic_write(0x370,0x00010000);    //Error
 
-	//NMI info
-	dword lint[2] = {0x00010000,0x00010000};
-
-	for (auto& p : madt->nmi_pins){
-		if (p.uid == 0xFF || p.uid == uid){
-			//	15 : LEVEL
-			//	13 : LOW_ACTIVE
-			dword new_value = 0x2400;	//NMI EDGE
-			if (1 == (p.mode & 0x03))
-				new_value &= ~(qword)0x2000;
-			if (0x0C == (p.mode & 0x0C))
-				new_value |= 0x8000;
-			if (p.pin > 1)
-				bugcheck("invalid NMI pin#%d",p.pin);
-			lint[p.pin] = new_value;
-		}
-	}
-	apic_write(0x350,lint[0]);    //LINT0
-	apic_write(0x360,lint[1]);    //LINT1
-
-	if (0 == (stat & 0x100)){	//not BSP
-		bugcheck("AP not_implemented");
-		return;
-	}
 	//disable 8259
 	//ports : 20 21 A0 A1
 	out_byte(0x20,0x11);
@@ -177,6 +128,78 @@ APIC::APIC(void) : table{0}{
 	}
 }
 
+void APIC::setup_local(void){
+	qword stat = rdmsr(MSR_APIC_BASE);
+	if (stat & 0x400){
+		//x2APIC, reset
+		stat &= (~0xC00);
+		wrmsr(MSR_APIC_BASE,stat);
+	}
+	wrmsr(MSR_APIC_BASE,stat | 0x800);
+
+	auto svr = apic_read(0xF0);
+	apic_write(0xF0,svr | 0x100);    //APIC enable
+
+	auto madt = acpi.get_madt();
+	bool res = false;
+	byte apic_id = id();
+	byte uid = 0;
+	for (auto& p : madt->processors){
+		if (p.apic_id == apic_id){
+			uid = p.uid;
+			res = true;
+			break;
+		}
+	}
+	if (!res)
+		bugcheck("APIC id#%x not found",apic_id);
+	dbgprint("CPU#%d APICid#%d %s",uid,apic_id,(stat & 0x100) ? "BSP" : "AP");
+	
+	//local APIC setup
+	
+	apic_write(0x2F0,0x00010000); //CMCI
+	apic_write(0x320,(dword)IRQ_APIC_TIMER);  //timer
+	apic_write(0x330,0x00010000);    //Thermal Monitor
+	apic_write(0x340,0x00010000);    //Perf Counter
+	apic_write(0x370,0x00010000);    //Error
+
+	//NMI info
+	dword lint[2] = {0x00010000,0x00010000};
+
+	for (auto& p : madt->nmi_pins){
+		if (p.uid == 0xFF || p.uid == uid){
+			//	15 : LEVEL
+			//	13 : LOW_ACTIVE
+			dword new_value = 0x2400;	//NMI EDGE
+			if (1 == (p.mode & 0x03))
+				new_value &= ~(qword)0x2000;
+			if (0x0C == (p.mode & 0x0C))
+				new_value |= 0x8000;
+			if (p.pin > 1)
+				bugcheck("invalid NMI pin#%d",p.pin);
+			lint[p.pin] = new_value;
+		}
+	}
+	apic_write(0x350,lint[0]);    //LINT0
+	apic_write(0x360,lint[1]);    //LINT1
+}
+
+void APIC::send_ipi(byte apic_id,dword command){
+	interrupt_guard<void> guard;
+	while(apic_read(0x300) & 0x1000)	//delivery pending
+		mm_pause();
+	apic_write(0x310,(dword)apic_id << 24);
+	apic_write(0x300,command);
+}
+
+void APIC::broadcast(byte irq){
+	interrupt_guard<void> guard;
+	while(apic_read(0x300) & 0x1000)	//delivery pending
+		mm_pause();
+	//shorthand : all excluding self
+	apic_write(0x300,0x000C0000 | irq);
+}
+
 byte APIC::id(void){
 	return (byte)(apic_read(0x20) >> 24);
 }
@@ -188,7 +211,7 @@ bool APIC::available(byte irq_index){
 	auto stat = io_apic_read(0x10 + 2*irq_index);
 	return stat & (1 << 16);
 }
-
+*/
 bool APIC::allocate(byte irq_index,bool level){
 	if (irq_index >= io_apic_entries)
 		return false;
@@ -203,7 +226,6 @@ bool APIC::allocate(byte irq_index,bool level){
 	io_apic_write(0x10 + 2*irq_index,stat);
 	return true;
 }
-*/
 
 APIC::CALLBACK APIC::get(byte irq) const{
 	if (irq >= IRQ_MIN && irq < IRQ_MAX){
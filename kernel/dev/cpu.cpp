@@ -2,9 +2,96 @@
 #include "lang.hpp"
 #include "constant.hpp"
 #include "intrinsics.hpp"
+#include "util.hpp"
+#include "lock_guard.hpp"
+#include "memory/include/vm.hpp"
 
 using namespace UOS;
 
+FPU::FPU(void) : mode(FXSAVE), area_size(sizeof(SSE_context)), xcr0(0), free_list(nullptr){
+	dword regs[4];
+	cpuid(1,0,regs);
+	if (regs[2] & (1 << 26)){	//XSAVE
+		mode = XSAVE;
+		xcr0 = 0x03;	//x87 & SSE
+		if (regs[2] & (1 << 28))	//AVX
+			xcr0 |= 0x04;
+		setup_local();
+		//size for features enabled in XCR0
+		cpuid(0x0D,0,regs);
+		area_size = regs[1];
+		cpuid(0x0D,1,regs);
+		if (regs[0] & 1)
+			mode = XSAVEOPT;
+	}
+	area_size = align_up(area_size,0x40);
+	dbgprint("FPU mode %d, XCR0 = %x, area size = %x",mode,xcr0,area_size);
+
+	//XSTATE_BV zero as init state, MXCSR always loaded
+	init_area = allocate();
+	*(word*)init_area = 0x037F;		//FCW
+	*(dword*)((byte*)init_area + 0x18) = 0x1F80;	//MXCSR
+}
+
+void FPU::setup_local(void){
+	if (mode == FXSAVE)
+		return;
+	write_cr4(read_cr4() | (1 << 18));	//OSXSAVE
+	xsetbv(0,xcr0);
+}
+
+SSE_context* FPU::allocate(void){
+	void* ptr;
+	{
+		interrupt_guard<spin_lock> guard(lock);
+		if (free_list == nullptr){
+			auto va = vm.reserve(0,chunk_page);
+			if (!va || !vm.commit(va,chunk_page))
+				bugcheck("vm.commit failed @ %p",va);
+			auto count = chunk_page*PAGE_SIZE/area_size;
+			for (unsigned i = 0;i < count;++i){
+				auto node = (void**)(va + i*area_size);
+				*node = free_list;
+				free_list = node;
+			}
+		}
+		ptr = free_list;
+		free_list = *(void**)ptr;
+	}
+	assert(0 == ((qword)ptr & 0x3F));
+	zeromemory(ptr,area_size);
+	return (SSE_context*)ptr;
+}
+
+void FPU::release(SSE_context* ptr){
+	assert(ptr && ptr != init_area);
+	interrupt_guard<spin_lock> guard(lock);
+	*(void**)ptr = free_list;
+	free_list = ptr;
+}
+
+void FPU::save(SSE_context* ptr){
+	switch(mode){
+		case XSAVEOPT:
+			xsaveopt(ptr,xcr0);
+			break;
+		case XSAVE:
+			xsave(ptr,xcr0);
+			break;
+		default:
+			fxsave(ptr);
+	}
+}
+
+void FPU::load(const SSE_context* ptr){
+	if (ptr == nullptr)
+		ptr = init_area;
+	if (mode == FXSAVE)
+		fxrstor(ptr);
+	else
+		xrstor(ptr,xcr0);
+}
+
 void UOS::build_IDT(void){
 	auto isr_ptr = reinterpret_cast<qword>(ISR_exception);
 	struct IDT{
@@ -33,9 +120,6 @@ void UOS::build_IDT(void){
 			case 0x12:	//MC
 				idt.ist = 2;
 				break;
-			case 0x0E:	//PF
-				idt.ist = 1;
-				break;
 			default:
 				idt.ist = 0;
 		}
@@ -59,10 +143,9 @@ void UOS::build_IDT(void){
 	}
 }
 
-void UOS::build_TSS(TSS* tss,qword stk_normal,qword stk_pf,qword stk_fatal){
+void UOS::build_TSS(TSS* tss,qword stk_normal,qword stk_fatal){
 	zeromemory(tss,sizeof(TSS));
 	tss->rsp0 = stk_normal;	//normal
-	tss->ist1 = stk_pf;		//#PF
 	tss->ist2 = stk_fatal;	//fatal
 
 	auto tss_addr = reinterpret_cast<qword>(tss);
@@ -23,8 +23,11 @@ namespace UOS{
 		static constexpr byte IRQ_MOUSE = IRQ_OFFSET + 0x0C;
 		static constexpr byte IRQ_IDE_PRI = IRQ_OFFSET + 0x0E;
 		static constexpr byte IRQ_IDE_SEC = IRQ_OFFSET + 0x0F;
+		//top vectors kept for IPI, external IRQ below
+		static constexpr byte IRQ_TLB = IRQ_MAX - 1;
+		static constexpr byte IRQ_RESCHED = IRQ_MAX - 2;
 
-		static_assert(IRQ_MAX - IRQ_MIN >= 28,"IRQ range error");
+		static_assert(IRQ_MAX - IRQ_MIN >= 30,"IRQ range error");
 	private:
 		struct irq_handler{
 			CALLBACK callback;
@@ -40,10 +43,17 @@ namespace UOS{
 		APIC(void);
 		APIC(const APIC&) = delete;
 		byte id(void);
+		//local APIC setup, called on every processor
+		void setup_local(void);
+		//ICR command to target APIC id
+		void send_ipi(byte apic_id,dword command);
+		//fixed IPI to all processors excluding self
+		void broadcast(byte irq);
 
 
 		//bool available(byte irq_index);
-		//bool allocate(byte irq_index,bool level);
+		//route a masked IOAPIC entry to this processor
+		bool allocate(byte irq_index,bool level);
 
 		CALLBACK get(byte irq) const;
 		void set(byte irq,CALLBACK callback,void* data = nullptr);
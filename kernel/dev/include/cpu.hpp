@@ -1,5 +1,7 @@
 #pragma once
 #include "types.h"
+#include "process/include/context.hpp"
+#include "sync/include/spin_lock.hpp"
 
 namespace UOS{
 	struct TSS{
@@ -20,8 +22,34 @@ namespace UOS{
 	} __attribute__((packed));
 	static_assert(sizeof(TSS) == 104,"TSS size mismatch");
 
+	//FPU state save & restore, XSAVE if supported
+	class FPU{
+		static constexpr unsigned chunk_page = 4;
+		enum : byte {FXSAVE, XSAVE, XSAVEOPT} mode;
+		dword area_size;
+		qword xcr0;
+		spin_lock lock;
+		//slab of aligned state areas
+		void* free_list;
+		//init state, restored for threads without saved state
+		SSE_context* init_area;
+	public:
+		FPU(void);
+		FPU(const FPU&) = delete;
+		//called on every processor
+		void setup_local(void);
+		SSE_context* allocate(void);
+		void release(SSE_context*);
+		void save(SSE_context*);
+		void load(const SSE_context*);
+		inline dword size(void) const{
+			return area_size;
+		}
+	};
+	extern FPU fpu;
+
 	void build_IDT(void);
-	void build_TSS(TSS* tss,qword stk_normal,qword stk_pf,qword stk_fatal);
+	void build_TSS(TSS* tss,qword stk_normal,qword stk_fatal);
 	void delay_us(word cnt = 1);
 }
 
@@ -31,4 +59,7 @@ extern "C"{
 	void service_entry(void);
 	[[ noreturn ]]
 	void service_exit(qword rip,qword module_base,qword command,qword rsp);
+	//copied to AP_ENTRY_PBASE for AP startup
+	extern const byte ap_trampoline[];
+	extern const byte ap_trampoline_end[];
 }
\ No newline at end of file
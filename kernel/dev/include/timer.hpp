@@ -3,7 +3,6 @@
 #include "sync/include/spin_lock.hpp"
 #include "process/include/waitable.hpp"
 #include "assert.hpp"
-#include "hash_set.hpp"
 
 namespace UOS{
 	class basic_timer{
@@ -13,16 +12,27 @@ namespace UOS{
 		static constexpr qword heartbeat_hz = (1000*1000)/heartbeat_us;
 		typedef void (*CALLBACK)(qword,void*);
 	private:
-		struct queue_type{
+		//4 levels of 64 slots, covers 2^24 heartbeats
+		static constexpr unsigned wheel_bits = 6;
+		static constexpr unsigned wheel_size = 1 << wheel_bits;
+		static constexpr unsigned wheel_level = 4;
+		//nodes allocated in chunks, index kept in low bits of ticket
+		//chunk list grows on demand, bounded by kernel heap before index_bits
+		static constexpr unsigned chunk_bits = 8;
+		static constexpr unsigned chunk_size = 1 << chunk_bits;
+		static constexpr unsigned index_bits = 24;
+
+		struct timer_node{
+			timer_node* next;
+			timer_node** prev;
 			qword ticket;
-			qword diff_tick;
+			qword expire;
 			CALLBACK func;
 			void* arg;
 			qword interval;
-
-			queue_type(qword t, qword d,CALLBACK f,void* a,qword i) : \
-				ticket(t), diff_tick(d), func(f), arg(a), interval(i) {}
-			queue_type(const queue_type&) = delete;
+			dword index;
+			byte level;
+			byte slot;
 		};
 
 		spin_lock lock;
@@ -31,23 +41,78 @@ namespace UOS{
 		volatile dword beat_counter;
 		qword running_us;
 		qword conductor;
-		hash_set<qword,UOS::hash<qword>,UOS::equal_to<qword> > record;
-		linked_list<queue_type> delta_queue;
+
+		//heartbeats stepped so far
+		qword wheel_tick;
+		timer_node* wheel[wheel_level][wheel_size];
+		//bit set for each non-empty slot
+		qword slot_mask[wheel_level];
+		timer_node** chunk_list;
+		unsigned chunk_count;
+		unsigned chunk_capacity;
+		timer_node* free_list;
+
+		//one-shot comparator for sub-heartbeat deadlines, 0 if none
+		byte fine_index;
+		byte fine_irq;
+		//sorted by HPET count
+		timer_node* fine_list;
+
+		//shared with user space, seqlock protected
+		TIME_PAGE volatile* time_page;
+		qword time_page_pa;
+
+		//HPET count of one heartbeat
+		qword beat_count;
+		//HPET counter when entering one-shot mode
+		qword suspend_count;
+		volatile bool suspended;
+
+		//scheduler tick, driven by heartbeat
+		volatile bool tick_on;
+		dword tick_interval;
+		dword tick_counter;
+		CALLBACK tick_func;
+		void* tick_arg;
 
 		static bool irq_timer(byte,void*);
+		static bool irq_fine(byte,void*);
 		void on_timer(void);
 		void on_second(void);
 		void step(unsigned count);
+		timer_node* alloc_node(void);
+		void free_node(timer_node*);
+		void link(timer_node*);
+		void unlink(timer_node*);
+		void cascade(unsigned level);
+		void fine_link(timer_node*);
+		void fine_arm(void);
+		void setup_fine(unsigned comparator_count);
+		void setup_page(void);
+		void update_page(bool second);
+		qword next_expire(void) const;
 		qword set_timer(unsigned,byte,qword);
+		void set_comparator(qword count,bool periodic);
 		friend class RTC;
 	public:
 		basic_timer(void);
 		basic_timer(const basic_timer&) = delete;
 		qword wait(qword us, CALLBACK func, void* arg, bool repeat = false);
 		bool cancel(qword ticket);
+		void set_tick(qword us, CALLBACK func, void* arg);
+		//safe in any context
+		void tick(bool on);
+		//interrupt disabled, one-shot till next deadline if tick stopped
+		bool suspend(void);
 		inline qword running_time(void) const{
 			return running_us;
 		}
+		//monotonic, HPET resolution if present
+		qword clock_ns(void) const;
+		//physical page of TIME_PAGE
+		inline qword get_page(void) const{
+			return time_page_pa;
+		}
 	};
 	extern basic_timer timer;
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "constant.hpp"
 #include "acpi.hpp"
 #include "dev/include/apic.hpp"
+#include "dev/include/rtc.hpp"
 #include "memory/include/vm.hpp"
 #include "lock_guard.hpp"
 #include "intrinsics.hpp"
@@ -28,7 +29,7 @@ qword basic_timer::set_timer(unsigned index,byte sel,qword us){
 }
 
 
-basic_timer::basic_timer(void) : base(nullptr){
+basic_timer::basic_timer(void) : base(nullptr), fine_index(0), fine_irq(0){
 	auto hpet = acpi.get_hpet();
 	if (hpet == nullptr){
 		//fallback to 8254
@@ -65,6 +66,7 @@ basic_timer::basic_timer(void) : base(nullptr){
 
 		//channel 0 as heartbeat
 		auto count = set_timer(0,2,heartbeat_us);
+		beat_count = count;
 
 		for (unsigned i = 0;i < comarator_count;++i){
 			qword state = *(base + (0x100 + i*0x20)/sizeof(qword));
@@ -73,40 +75,345 @@ basic_timer::basic_timer(void) : base(nullptr){
 
 		*(base + 0x10/sizeof(qword)) = main_switch | 1;	//enable counter
 		dbgprint("Timer using HPET with count = %d",count);
+		setup_fine(comarator_count);
 	}
 	conductor = 0;
 	running_us = 0;
 	beat_counter = 0;
+	wheel_tick = 0;
+	zeromemory(wheel,sizeof(wheel));
+	zeromemory(slot_mask,sizeof(slot_mask));
+	chunk_list = nullptr;
+	chunk_count = 0;
+	chunk_capacity = 0;
+	free_list = nullptr;
+	fine_list = nullptr;
+	setup_page();
+	suspend_count = 0;
+	suspended = false;
+	tick_on = false;
+	tick_interval = 0;
+	tick_counter = 0;
+	tick_func = nullptr;
+	tick_arg = nullptr;
 	apic.set(APIC::IRQ_PIT, irq_timer,this);
 }
 
-qword basic_timer::wait(qword us, CALLBACK func, void* arg, bool repeat){
+//comparator #1 as one-shot, routed to a spare IOAPIC entry
+void basic_timer::setup_fine(unsigned comparator_count){
+	if (comparator_count < 2)
+		return;
+	auto config = base + 0x120/sizeof(qword);
+	qword state = *config;
+	if (0 == (state & 0x20))
+		return;
+	dword route = state >> 32;
+	//ISA entries are taken, search from 16
+	for (byte pin = 16;pin < APIC::IRQ_RESCHED - APIC::IRQ_OFFSET;++pin){
+		if (0 == (route & (1U << pin)))
+			continue;
+		if (!apic.allocate(pin,false))
+			continue;
+		*(base + 0x128/sizeof(qword)) = (qword)(-1);
+		state &= ~((1 << 14) | (1 << 8) | (1 << 3) | (1 << 1));	//64-bit, no-FSB, one-shot, edge triggered
+		state &= ~(qword)(0x1F << 9);
+		state |= ((qword)pin << 9) | (1 << 2);
+		*config = state;
+		fine_index = 1;
+		fine_irq = APIC::IRQ_OFFSET + pin;
+		apic.set(fine_irq,irq_fine,this);
+		dbgprint("comparator #1 one-shot on IRQ#%d",pin);
+		return;
+	}
+}
+
+void basic_timer::setup_page(void){
+	auto va = vm.reserve(0,1);
+	if (!va || !vm.commit(va,1))
+		bugcheck("vm.commit failed @ %p",va);
+	zeromemory((void*)va,PAGE_SIZE);
+	time_page = (TIME_PAGE volatile*)va;
+	time_page_pa = vm.peek(va).page_addr << 12;
+
+	dword regs[4];
+	cpuid(0x80000000,0,regs);
+	if (base == nullptr || regs[0] < 0x80000007)
+		return;
+	cpuid(0x80000007,0,regs);
+	if (0 == (regs[3] & (1 << 8))){
+		dbgprint("TSC not invariant");
+		return;
+	}
+	//calibrate TSC against HPET for 10 heartbeats
+	auto counter = base + 0xF0/sizeof(qword);
+	auto hpet_begin = *counter;
+	auto tsc_begin = rdtsc();
+	while(*counter - hpet_begin < 10*beat_count)
+		mm_pause();
+	auto tsc_end = rdtsc();
+	auto hpet_end = *counter;
+	qword ns = (hpet_end - hpet_begin)*tick_fs/(1000*1000);
+	qword mul = (ns << 32)/(tsc_end - tsc_begin);
+	//keep 32x32 multiply in libuos, requires TSC faster than 1GHz
+	if (mul >> 32){
+		dbgprint("TSC too slow, mul = %x",mul);
+		return;
+	}
+	time_page->tsc_mul = mul;
+	dbgprint("TSC mul = %x",mul);
+}
+
+//called by heartbeat & RTC on BSP
+void basic_timer::update_page(bool second){
+	auto page = time_page;
+	++page->sequence;
+	if (second)
+		page->wall_time = rtc.get_time();
+	page->running_us = running_us;
+	page->clock_ns = clock_ns();
+	page->tsc_base = rdtsc();
+	++page->sequence;
+}
+
+qword basic_timer::clock_ns(void) const{
+	if (base == nullptr)
+		return running_us*1000;
+	qword count = *(base + 0xF0/sizeof(qword));
+	constexpr qword fs2ns = 1000*1000;
+	//split to avoid overflow
+	return (count / fs2ns)*tick_fs + (count % fs2ns)*tick_fs / fs2ns;
+}
+
+//comparator #0 relative to current counter
+void basic_timer::set_comparator(qword count,bool periodic){
+	auto config = base + 0x100/sizeof(qword);
+	auto comparator = base + 0x108/sizeof(qword);
+	qword state = *config;
+	if (periodic)
+		state |= (1 << 6) | (1 << 3) | (1 << 2);	//set_comparator, periodic, enable
+	else{
+		state &= ~(qword)(1 << 3);
+		state |= (1 << 2);	//one-shot, enable
+	}
+	*config = state;
+	*comparator = *(base + 0xF0/sizeof(qword)) + count;
+	if (periodic)
+		*comparator = count;	//set adder
+}
+
+void basic_timer::set_tick(qword us, CALLBACK func, void* arg){
 	interrupt_guard<spin_lock> guard(lock);
-	auto ticket = ++conductor;
-	record.insert(ticket);
+	tick_interval = max<qword>(us/heartbeat_us,1);
+	tick_counter = 0;
+	tick_func = func;
+	tick_arg = arg;
+	tick_on = true;
+}
 
-	auto total_tick = max<qword>(us/heartbeat_us,1);
-	auto delta_tick = total_tick;
-	auto it = delta_queue.begin();
-	while(it != delta_queue.end()){
-		if (delta_tick <= it->diff_tick){
-			it->diff_tick -= delta_tick;
-			delta_queue.insert(it,ticket,delta_tick,func,arg,repeat ? total_tick : 0);
-			return ticket;
+void basic_timer::tick(bool on){
+	if (tick_on == on)
+		return;
+	xchg(&tick_on,on);
+	if (on && suspended){
+		//fire as soon as possible to leave one-shot mode
+		*(base + 0x108/sizeof(qword)) = *(base + 0xF0/sizeof(qword)) + beat_count/0x10;
+	}
+}
+
+bool basic_timer::suspend(void){
+	IF_assert;
+	if (base == nullptr || tick_on)
+		return false;
+	qword delta_tick = heartbeat_hz;
+	{
+		lock_guard<spin_lock> guard(lock);
+		delta_tick = min(delta_tick,next_expire());
+	}
+	if (delta_tick <= 1)
+		return false;
+	suspend_count = *(base + 0xF0/sizeof(qword));
+	xchg(&suspended,true);
+	if (tick_on){
+		//raced with tick(true)
+		suspended = false;
+		return false;
+	}
+	set_comparator(delta_tick*beat_count,false);
+	//tick(true) may have kicked before set_comparator, kick again
+	//UC access above keeps this load after the comparator write
+	if (tick_on)
+		*(base + 0x108/sizeof(qword)) = *(base + 0xF0/sizeof(qword)) + beat_count/0x10;
+	return true;
+}
+
+basic_timer::timer_node* basic_timer::alloc_node(void){
+	assert(lock.is_locked());
+	if (free_list == nullptr){
+		if (chunk_count == chunk_capacity){
+			//double the chunk list, old nodes stay in place
+			auto capacity = chunk_capacity ? 2*chunk_capacity : 0x10;
+			assert((qword)capacity*chunk_size <= ((qword)1 << index_bits));
+			auto list = (timer_node**)operator new(sizeof(timer_node*)*capacity);
+			if (chunk_count)
+				memcpy(list,chunk_list,sizeof(timer_node*)*chunk_count);
+			if (chunk_list)
+				operator delete(chunk_list,sizeof(timer_node*)*chunk_capacity);
+			chunk_list = list;
+			chunk_capacity = capacity;
+		}
+		auto chunk = (timer_node*)operator new(sizeof(timer_node)*chunk_size);
+		zeromemory(chunk,sizeof(timer_node)*chunk_size);
+		for (unsigned i = 0;i < chunk_size;++i){
+			chunk[i].index = chunk_count*chunk_size + i;
+			chunk[i].next = free_list;
+			free_list = chunk + i;
 		}
-		delta_tick -= it->diff_tick;
-		++it;
+		chunk_list[chunk_count++] = chunk;
+	}
+	auto node = free_list;
+	free_list = node->next;
+	return node;
+}
+
+void basic_timer::free_node(timer_node* node){
+	node->ticket = 0;
+	node->prev = nullptr;
+	node->next = free_list;
+	free_list = node;
+}
+
+//put into slot by remaining heartbeats
+void basic_timer::link(timer_node* node){
+	assert(node->expire >= wheel_tick);
+	auto delta = node->expire - wheel_tick;
+	auto expire = node->expire;
+	constexpr qword range = (qword)1 << (wheel_bits*wheel_level);
+	if (delta >= range){
+		//park on top level, relinked on cascade
+		delta = range - 1;
+		expire = wheel_tick + delta;
 	}
-	delta_queue.push_back(ticket,delta_tick,func,arg,repeat ? total_tick : 0);
-	return ticket;
+	unsigned level = 0;
+	while(delta >> (wheel_bits*(level + 1)))
+		++level;
+	assert(level < wheel_level);
+	unsigned slot = (expire >> (wheel_bits*level)) & (wheel_size - 1);
+	auto& head = wheel[level][slot];
+	node->level = level;
+	node->slot = slot;
+	node->prev = &head;
+	node->next = head;
+	if (head)
+		head->prev = &node->next;
+	head = node;
+	slot_mask[level] |= (qword)1 << slot;
+}
+
+void basic_timer::unlink(timer_node* node){
+	*node->prev = node->next;
+	if (node->next)
+		node->next->prev = node->prev;
+	if (node->level < wheel_level && wheel[node->level][node->slot] == nullptr)
+		slot_mask[node->level] &= ~((qword)1 << node->slot);
+}
+
+//short list, linear insert is fine
+void basic_timer::fine_link(timer_node* node){
+	node->level = wheel_level;
+	node->slot = 0;
+	auto pos = &fine_list;
+	while(*pos && (*pos)->expire <= node->expire)
+		pos = &(*pos)->next;
+	node->prev = pos;
+	node->next = *pos;
+	if (*pos)
+		(*pos)->prev = &node->next;
+	*pos = node;
+}
+
+void basic_timer::fine_arm(void){
+	auto comparator = base + (0x108 + 0x20*fine_index)/sizeof(qword);
+	if (fine_list == nullptr){
+		*comparator = (qword)(-1);
+		return;
+	}
+	*comparator = fine_list->expire;
+	if (*(base + 0xF0/sizeof(qword)) >= fine_list->expire){
+		//missed the edge, raise it on this core
+		apic.send_ipi(apic.id(),fine_irq);
+	}
+}
+
+//move current slot of 'level' to lower levels
+void basic_timer::cascade(unsigned level){
+	unsigned slot = (wheel_tick >> (wheel_bits*level)) & (wheel_size - 1);
+	auto node = wheel[level][slot];
+	wheel[level][slot] = nullptr;
+	slot_mask[level] &= ~((qword)1 << slot);
+	while(node){
+		auto next = node->next;
+		link(node);
+		node = next;
+	}
+}
+
+//heartbeats till next slot to process, ~0 if none
+qword basic_timer::next_expire(void) const{
+	qword res = (qword)(-1);
+	unsigned cur = wheel_tick & (wheel_size - 1);
+	for (unsigned level = 1;level < wheel_level;++level){
+		if (slot_mask[level]){
+			//wake up on next cascade
+			res = wheel_size - cur;
+			break;
+		}
+	}
+	auto mask = slot_mask[0];
+	if (mask){
+		//rotate so that bit 0 stands for next heartbeat
+		unsigned shift = (cur + 1) & (wheel_size - 1);
+		if (shift)
+			mask = (mask >> shift) | (mask << (wheel_size - shift));
+		res = min<qword>(res,bsf(mask) + 1);
+	}
+	return res;
+}
+
+qword basic_timer::wait(qword us, CALLBACK func, void* arg, bool repeat){
+	interrupt_guard<spin_lock> guard(lock);
+	auto node = alloc_node();
+	auto total_tick = max<qword>(us/heartbeat_us,1);
+	node->ticket = (++conductor << index_bits) | node->index;
+	node->func = func;
+	node->arg = arg;
+	if (fine_index && !repeat && us < heartbeat_us){
+		node->expire = *(base + 0xF0/sizeof(qword)) + us*us2fs/tick_fs;
+		node->interval = 0;
+		fine_link(node);
+		if (fine_list == node)
+			fine_arm();
+		return node->ticket;
+	}
+	node->expire = wheel_tick + total_tick;
+	node->interval = repeat ? total_tick : 0;
+	link(node);
+	return node->ticket;
 }
 
 bool basic_timer::cancel(qword ticket){
 	interrupt_guard<spin_lock> guard(lock);
-	auto it = record.find(ticket);
-	if (it == record.end())
+	unsigned index = ticket & ((1 << index_bits) - 1);
+	if (index >= chunk_count*chunk_size)
+		return false;
+	auto node = chunk_list[index >> chunk_bits] + (index & (chunk_size - 1));
+	//already fired or cancelled
+	if (node->ticket != ticket || node->prev == nullptr)
 		return false;
-	record.erase(it);
+	bool head = (node == fine_list);
+	unlink(node);
+	free_node(node);
+	if (head)
+		fine_arm();
 	return true;
 }
 
@@ -114,49 +421,33 @@ void basic_timer::step(unsigned count){
 	IF_assert;
 	assert(count);
 	lock_guard<spin_lock> guard(lock);
-	decltype(delta_queue) periodic_list;
-	while(!delta_queue.empty()){
-		auto& cur = delta_queue.front();
-		if (cur.diff_tick > count){
-			cur.diff_tick -= count;
-			break;
-		}
-		count -= cur.diff_tick;
-		auto rec = record.find(cur.ticket);
-		if (rec == record.end()){
-			delta_queue.pop_front();
-			continue;
+	while(count--){
+		++wheel_tick;
+		for (unsigned level = 1;level < wheel_level;++level){
+			if (wheel_tick & (((qword)1 << (wheel_bits*level)) - 1))
+				break;
+			cascade(level);
 		}
-		//callback here
-		cur.func(cur.ticket,cur.arg);
-
-		if (!cur.interval){
-			//one-shot
-			record.erase(rec);
-			delta_queue.pop_front();
+		unsigned slot = wheel_tick & (wheel_size - 1);
+		auto node = wheel[0][slot];
+		if (node == nullptr)
 			continue;
-		}
-		//periodic
-		auto node = delta_queue.get_node(delta_queue.begin());
-		cur.diff_tick = (cur.interval > count) ? (cur.interval - count) : 0;
-		periodic_list.put_node(periodic_list.begin(),node);
-	}
-	while(!periodic_list.empty()){
-		auto node = periodic_list.get_node(periodic_list.begin());
-		auto& cur = node->payload;
-		auto it = delta_queue.begin();
-		while(true){
-			if (it == delta_queue.end()){
-				delta_queue.put_node(it,node);
-				break;
-			}
-			if (cur.diff_tick <= it->diff_tick){
-				it->diff_tick -= cur.diff_tick;
-				delta_queue.put_node(it,node);
-				break;
+		wheel[0][slot] = nullptr;
+		slot_mask[0] &= ~((qword)1 << slot);
+		while(node){
+			auto next = node->next;
+			assert(node->expire == wheel_tick);
+			//detached while calling back
+			node->prev = nullptr;
+			node->func(node->ticket,node->arg);
+			if (node->interval){
+				//periodic
+				node->expire = wheel_tick + node->interval;
+				link(node);
 			}
-			cur.diff_tick -= it->diff_tick;
-			++it;
+			else
+				free_node(node);
+			node = next;
 		}
 	}
 }
@@ -167,15 +458,49 @@ void basic_timer::on_second(void){
 	beat_counter = 0;
 	dbgprint("beat = %d",val);
 	running_us += heartbeat_us*adjust_tick;
+	update_page(true);
 	if (adjust_tick)
 		step(adjust_tick);
 }
 
 void basic_timer::on_timer(void){
 	IF_assert;
-	++beat_counter;
-	running_us += heartbeat_us;
-	step(1);
+	unsigned count = 1;
+	if (suspended){
+		//back from one-shot mode, catch up skipped heartbeats
+		auto elapsed = *(base + 0xF0/sizeof(qword)) - suspend_count;
+		count = max<qword>(elapsed/beat_count,1);
+		set_comparator(beat_count,true);
+		suspended = false;
+	}
+	beat_counter += count;
+	running_us += heartbeat_us*count;
+	update_page(false);
+	step(count);
+	if (tick_on){
+		tick_counter += count;
+		if (tick_counter >= tick_interval){
+			tick_counter = 0;
+			tick_func(running_us,tick_arg);
+		}
+	}
+}
+
+bool basic_timer::irq_fine(byte irq,void* ptr){
+	IF_assert;
+	auto self = (basic_timer*)ptr;
+	assert(irq == self->fine_irq);
+	lock_guard<spin_lock> guard(self->lock);
+	auto count = *(self->base + 0xF0/sizeof(qword));
+	while(self->fine_list && self->fine_list->expire <= count){
+		auto node = self->fine_list;
+		self->unlink(node);
+		node->prev = nullptr;
+		node->func(node->ticket,node->arg);
+		self->free_node(node);
+	}
+	self->fine_arm();
+	return false;
 }
 
 bool basic_timer::irq_timer(byte irq,void* ptr){
@@ -12,30 +12,23 @@ using namespace UOS;
 #define MAKE_ERROR_CODE(id) (0xC0000000UL | (id))
 
 
+//user stack grows on demand, kernel stacks are fully committed
 byte UOS::check_guard_page(qword va){
+	if (IS_HIGHADDR(va))
+		return 0;
 	this_core core;
 	auto this_thread = core.this_thread();
-	qword bot,top;
-	virtual_space* vspace;
-	if (IS_HIGHADDR(va)){
-		top = this_thread->krnl_stk_top;
-		bot = top - this_thread->krnl_stk_reserved;
-		vspace = &vm;
-	}
-	else{
-		top = this_thread->user_stk_top;
-		bot = top - this_thread->user_stk_reserved;
-		vspace = this_thread->get_process()->vspace;
-	}
+	qword top = this_thread->user_stk_top;
+	qword bot = top - this_thread->user_stk_reserved;
+	virtual_space* vspace = this_thread->get_process()->vspace;
 	do{
 		//valid stack range
 		if (top == 0 || (top & PAGE_MASK) || (bot & PAGE_MASK) || top == bot)
 			break;
 		top -= PAGE_SIZE;
-		if (IS_HIGHADDR(va) != IS_HIGHADDR(top))
+		if (IS_HIGHADDR(top))
 			break;
-		if (!IS_HIGHADDR(va))
-			bot -= PAGE_SIZE;
+		bot -= PAGE_SIZE;
 		//should in stack range
 		if (va >= top || va < bot)
 			break;
@@ -45,7 +38,7 @@ byte UOS::check_guard_page(qword va){
 			break;
 		if (!vspace->commit(align_down(va,PAGE_SIZE),1))
 			break;
-		if (!IS_HIGHADDR(va) && align_down(va,PAGE_SIZE) == bot){
+		if (align_down(va,PAGE_SIZE) == bot){
 			return 0x80;
 		}
 		return 1;
@@ -53,6 +46,19 @@ byte UOS::check_guard_page(qword va){
 	return 0;
 }
 
+extern "C" const qword user_access_table[];
+
+//kernel fault in user_copy or user_zero, resumes at fixup with bytes left
+static bool fixup_user_access(context* context){
+	for (auto ptr = user_access_table;*ptr;ptr += 2){
+		if (context->rip == ptr[0]){
+			context->rip = ptr[1];
+			return true;
+		}
+	}
+	return false;
+}
+
 struct PF_STATE{
 	byte P : 1;
 	byte W : 1;
@@ -70,19 +76,27 @@ byte on_page_fault(qword errcode,qword va,context* context){
 		bugcheck("#PF state.R set (%x) @ %p",errcode,va);
 
 	PTE pt;
+	virtual_space* vspace;
 	if (IS_HIGHADDR(va)){
-		pt = vm.peek(va);
+		vspace = &vm;
 	}
 	else{
 		this_core core;
-		pt = core.this_thread()->get_process()->vspace->peek(va);
+		vspace = core.this_thread()->get_process()->vspace;
 	}
+	pt = vspace->peek(va);
 
 	do{
 		if (0 == state.P){
 			if (pt.present)
 				bugcheck("#PF state.P mismatch (%x,%x) @ %p",errcode,*(qword*)&pt,va);
 			else{
+				if (pt.lazy()){
+					//first touch, check access against recorded attributes
+					if ((state.W && !pt.write) || (state.I && pt.xd) || (state.U && !pt.user))
+						break;
+					return vspace->fault_in(va) ? 1 : 0;
+				}
 				if (pt.preserve){
 					return check_guard_page(va);
 				}
@@ -91,6 +105,12 @@ byte on_page_fault(qword errcode,qword va,context* context){
 		}
 		if (state.I && state.W)
 			bugcheck("#PF invalid state (%x) @ %p",errcode,va);
+		if (state.W && pt.cow()){
+			//first write after clone
+			if (state.U && !pt.user)
+				break;
+			return vspace->copy_on_write(va) ? 1 : 0;
+		}
 		
 		if (state.I){
 			if (pt.xd)
@@ -115,6 +135,8 @@ void on_fpu_switch(context* context){
 	auto this_thread = core.this_thread();
 	auto owner = core.fpu_owner();
 	clts();
+	this_thread->fpu_used();
+	this_thread->account(&SCHED_STAT::fpu_trap);
 	if (this_thread == owner)
 		return;
 	if (owner){
@@ -149,6 +171,9 @@ bool on_dispatch(byte id,qword errcode,context* context){
 	}
 	if ((context->cs & 0x03) != 0x03){
 		assert(context->cs == SEG_KRNL_CS);
+		//bad user pointer, non-canonical one raises #GP
+		if (id == 0x0E || id == 0x0D)
+			return fixup_user_access(context);
 		return false;
 	}
 	if (!user_exception(context->rip,context->rsp,MAKE_ERROR_CODE(id))){
@@ -1,4 +1,5 @@
 #include "file.hpp"
+#include "image_cache.hpp"
 #include "lock_guard.hpp"
 #include "process/include/core_state.hpp"
 #include "process/include/process.hpp"
@@ -98,6 +99,8 @@ dword file::write(const void* sor,dword len){
 		command = COMMAND_WRITE;
 		iostate = 0;
 	}
+	//later launch reads new content
+	img_cache.invalidate(instance);
 	filesystem.task(this);
 	return 0;
 }
@@ -220,3 +223,38 @@ folder_instance* file::open_wd(folder_instance* cwd,const span<char>& path){
 	assert(!ins || ins->is_folder());
 	return static_cast<folder_instance*>(ins);
 }
+
+//hosted by kernel process, outlives the loading process if cloned
+file_source::file_source(file* f) : f(f->duplicate(proc.find(0,false))){}
+
+file_source::~file_source(void){
+	f->relax();
+}
+
+bool file_source::fill(qword off,void* page,dword length){
+	assert(IS_HIGHADDR(page));
+	lock_guard<rwlock> guard(io_lock);
+	if (!f->seek(off) || f->state() != 0 || f->tell() != off)
+		return false;
+	f->read(page,length);
+	f->wait();
+	return f->state() == 0 && f->result() == length;
+}
+
+bool file_source::flush(qword off,const void* page,dword length){
+	assert(IS_HIGHADDR(page));
+	lock_guard<rwlock> guard(io_lock);
+	if (!f->seek(off) || f->state() != 0 || f->tell() != off)
+		return false;
+	f->write(page,length);
+	f->wait();
+	return f->state() == 0 && f->result() == length;
+}
+
+qword file_source::share(qword off,dword length){
+	return img_cache.get(f->instance,off,length,this);
+}
+
+void file_source::unshare(qword off,qword pa){
+	img_cache.put(f->instance,off,pa);
+}
@@ -0,0 +1,169 @@
+#include "image_cache.hpp"
+#include "instance.hpp"
+#include "memory/include/pm.hpp"
+#include "lock_guard.hpp"
+#include "util.hpp"
+
+using namespace UOS;
+
+image_cache::image* image_cache::imp_find(const file_instance* ins){
+	assert(objlock.is_locked());
+	for (auto& slot : table){
+		if (slot.instance == ins)
+			return &slot;
+	}
+	return nullptr;
+}
+
+file_instance* image_cache::imp_evict(image& slot){
+	assert(objlock.is_locked());
+	auto ins = slot.instance;
+	if (ins == nullptr)
+		return nullptr;
+	auto it = frames.begin();
+	while(it != frames.end()){
+		if (it->instance != ins || it->detached){
+			++it;
+			continue;
+		}
+		assert(frame_count && slot.frame_count);
+		--frame_count;
+		--slot.frame_count;
+		if (it->ref_count){
+			it->detached = true;
+			++it;
+			continue;
+		}
+		pm.release(it->pa);
+		it = frames.erase(it);
+	}
+	assert(slot.frame_count == 0);
+	slot.instance = nullptr;
+	return ins;
+}
+
+qword image_cache::get(file_instance* ins,qword offset,dword length,page_source* source){
+	assert(ins && source);
+	if ((offset & PAGE_MASK) || length == 0 || length > PAGE_SIZE)
+		return 0;
+	file_instance* victim = nullptr;
+	{
+		interrupt_guard<spin_lock> guard(objlock);
+		auto it = frames.find(key_type{ins,offset,0});
+		if (it != frames.end()){
+			//same offset but different length, not shareable
+			if (it->length != length)
+				return 0;
+			++it->ref_count;
+			auto slot = imp_find(ins);
+			assert(slot);
+			slot->timestamp = ++ticket;
+			return it->pa;
+		}
+		//make room before filling, evicts least recently used image
+		if (frame_count >= max_frame || pm.available() < 2*(qword)pm.get_critical_limit()){
+			image* lru = nullptr;
+			for (auto& slot : table){
+				if (slot.instance && slot.instance != ins && (lru == nullptr || slot.timestamp < lru->timestamp))
+					lru = &slot;
+			}
+			if (lru)
+				victim = imp_evict(*lru);
+		}
+	}
+	if (victim)
+		victim->relax();
+	auto pa = pm.allocate();
+	if (!pa)
+		return 0;
+	//file system writes through kernel address, bounce to frame
+	auto buffer = operator new(PAGE_SIZE);
+	auto res = source->fill(offset,buffer,length);
+	if (res){
+		map_view view(pa);
+		memcpy((void*)view,buffer,length);
+		zeromemory((byte*)view + length,PAGE_SIZE - length);
+	}
+	operator delete(buffer,PAGE_SIZE);
+	if (!res){
+		pm.release(pa);
+		return 0;
+	}
+	//pinned while in table, relaxed if not taken
+	ins->acquire();
+	file_instance* drop = ins;
+	victim = nullptr;
+	qword result = 0;
+	{
+		interrupt_guard<spin_lock> guard(objlock);
+		auto it = frames.find(key_type{ins,offset,0});
+		if (it != frames.end()){
+			//filled by other process meanwhile, own frame dropped
+			if (it->length == length){
+				++it->ref_count;
+				result = it->pa;
+				imp_find(ins)->timestamp = ++ticket;
+			}
+		}
+		else{
+			auto slot = imp_find(ins);
+			if (slot == nullptr){
+				slot = imp_find(nullptr);
+				if (slot == nullptr){
+					//every slot in use, reuse least recently used one
+					slot = table;
+					for (auto& cur : table){
+						if (cur.timestamp < slot->timestamp)
+							slot = &cur;
+					}
+					victim = imp_evict(*slot);
+				}
+				slot->instance = ins;
+				slot->frame_count = 0;
+				drop = nullptr;
+			}
+			slot->timestamp = ++ticket;
+			if (frame_count < max_frame){
+				frames.insert(ins,offset,pa,length);
+				++frame_count;
+				++slot->frame_count;
+				result = pa;
+			}
+		}
+	}
+	if (drop)
+		drop->relax();
+	if (victim)
+		victim->relax();
+	if (result != pa)
+		pm.release(pa);
+	return result;
+}
+
+void image_cache::put(const file_instance* ins,qword offset,qword pa){
+	assert(ins && pa);
+	interrupt_guard<spin_lock> guard(objlock);
+	auto it = frames.find(key_type{ins,offset,pa});
+	if (it == frames.end())
+		bugcheck("image_cache: frame %p not found",pa);
+	assert(it->ref_count);
+	if (--it->ref_count)
+		return;
+	//attached frame stays cached for later launch
+	if (it->detached){
+		pm.release(pa);
+		frames.erase(it);
+	}
+}
+
+void image_cache::invalidate(const file_instance* ins){
+	file_instance* victim = nullptr;
+	{
+		interrupt_guard<spin_lock> guard(objlock);
+		auto slot = imp_find(ins);
+		if (slot)
+			victim = imp_evict(*slot);
+	}
+	if (victim)
+		victim->relax();
+}
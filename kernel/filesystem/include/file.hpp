@@ -3,6 +3,7 @@
 #include "util.hpp"
 #include "process/include/waitable.hpp"
 #include "filesystem/include/instance.hpp"
+#include "memory/include/vm.hpp"
 #include "assert.hpp"
 
 namespace UOS{
@@ -18,6 +19,7 @@ namespace UOS{
 
 		enum : byte {COMMAND_READ = 1,COMMAND_WRITE = 2,COMMAND_LIST = 3};
 		friend class exfat;
+		friend class file_source;
 	protected:
 		//ins acquired before calling
 		file(file_instance* ins,process* ps);
@@ -49,4 +51,20 @@ namespace UOS{
 		qword size(void) const;
 		string get_path(void) const;
 	};
-}
\ No newline at end of file
+
+	//file backed pages, see user_vspace::map_source
+	class file_source : public page_source{
+		file* const f;
+		//seek & transfer on 'f', source shared by vspaces after clone
+		rwlock io_lock;
+	public:
+		//'f' duplicated inside
+		file_source(file* f);
+		~file_source(void);
+		bool fill(qword offset,void* page,dword length) override;
+		bool flush(qword offset,const void* page,dword length) override;
+		//frames kept in img_cache, shared by instance
+		qword share(qword offset,dword length) override;
+		void unshare(qword offset,qword pa) override;
+	};
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "types.h"
+#include "constant.hpp"
+#include "assert.hpp"
+#include "hash.hpp"
+#include "hash_set.hpp"
+#include "sync/include/spin_lock.hpp"
+#include "memory/include/vm.hpp"
+
+namespace UOS{
+	class file_instance;
+
+	//read-only frames of recently used images, shared between processes
+	//see file_source::share & user_vspace::fault_in
+	class image_cache{
+		static constexpr dword max_image = 8;
+		static constexpr dword max_frame = 0x1000;
+
+		struct frame{
+			const file_instance* instance;
+			qword offset;
+			qword pa;
+			dword length;
+			dword ref_count = 1;
+			//image evicted, freed on last put
+			bool detached = false;
+
+			frame(const file_instance* ins,qword off,qword pa,dword len) : instance(ins), offset(off), pa(pa), length(len) {}
+		};
+		//pa == 0 matches attached frame only
+		struct key_type{
+			const file_instance* instance;
+			qword offset;
+			qword pa;
+		};
+		struct hash{
+			struct pair{
+				const file_instance* instance;
+				qword offset;
+			};
+			UOS::hash<pair> h;
+			qword operator()(const frame& obj){
+				return h(pair{obj.instance,obj.offset});
+			}
+			qword operator()(const key_type& key){
+				return h(pair{key.instance,key.offset});
+			}
+		};
+		struct equal{
+			bool operator()(const frame& obj,const key_type& key){
+				if (obj.instance != key.instance || obj.offset != key.offset)
+					return false;
+				return key.pa ? (obj.pa == key.pa) : !obj.detached;
+			}
+		};
+		struct image{
+			//acquired while in table
+			file_instance* instance;
+			qword timestamp;
+			dword frame_count;
+		};
+
+		spin_lock objlock;
+		qword ticket = 0;
+		dword frame_count = 0;
+		image table[max_image] = {0};
+		hash_set<frame,hash,equal> frames;
+
+		//locked before calling, returns instance to relax
+		file_instance* imp_evict(image& slot);
+		//locked before calling, slot of 'ins' or nullptr
+		image* imp_find(const file_instance* ins);
+	public:
+		image_cache(void) = default;
+		image_cache(const image_cache&) = delete;
+
+		//referenced frame with 'length' bytes at 'offset' of 'ins', 0 if not cached & cannot cache
+		//content filled from 'source' on miss, may sleep
+		qword get(file_instance* ins,qword offset,dword length,page_source* source);
+		void put(const file_instance* ins,qword offset,qword pa);
+		//drops frames of 'ins', mapped frames kept until put
+		void invalidate(const file_instance* ins);
+	};
+	extern image_cache img_cache;
+}
@@ -8,6 +8,7 @@
 #include "memory/include/vm.hpp"
 #include "process/include/process.hpp"
 #include "process/include/core_state.hpp"
+#include "dev/include/cpu.hpp"
 #include "dev/include/acpi.hpp"
 #include "dev/include/apic.hpp"
 #include "dev/include/timer.hpp"
@@ -18,6 +19,7 @@
 #include "dev/include/ide.hpp"
 #include "dev/include/disk_interface.hpp"
 #include "filesystem/include/exfat.hpp"
+#include "filesystem/include/image_cache.hpp"
 #include "interface/include/object.hpp"
 
 namespace UOS{
@@ -43,16 +45,18 @@ namespace UOS{
 			req_size = PAGE_SIZE;
 		}while(true);
 	});
+	cow_table cow_frames;
+	FPU fpu;
 	ACPI acpi;
 	PCI pci;
 	process_manager proc;
-	scheduler ready_queue;
 
 	APIC apic;
 	basic_timer timer;
 	RTC rtc;
 	core_manager cores;
 	gc_service gc;
+	zero_service zero_worker;
 	object_manager named_obj;
 	video_memory display;
 	PS_2 ps2_device;
@@ -64,4 +68,5 @@ namespace UOS{
 		return total;
 	}(pm.capacity()));
 	exfat filesystem(0x10);
+	image_cache img_cache;
 }
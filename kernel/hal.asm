@@ -7,8 +7,12 @@ GDT_LIM equ 0x600	;96 entries
 IDT_BASE equ (HIGHADDR+0x0C00)
 IDT_LIM equ 0x400	;64 entries
 
+SEG_KRNL_CS equ 0x08
+SEG_KRNL_SS equ 0x10
 SEG_USER_SS equ 0x2B
 
+AP_ENTRY_PBASE equ 0xF000
+
 ; NOTE: according to x64 calling convention, 0x20 space on stack needed before calling C functions
 
 extern dispatch_exception
@@ -27,8 +31,15 @@ global DR_set
 
 global bugcheck_raise
 
+global user_copy
+global user_zero
+global user_access_table
+
 global keycode
 
+global ap_trampoline
+global ap_trampoline_end
+
 section .text
 
 ; 0 ~ 7, 9, 15, 16, 18, 19 no errcode
@@ -53,6 +64,36 @@ ISR_STUB i
 %endrep
 
 exception_entry:
+;+30	SS
+;+28	rsp
+;+20	rflags
+;+18	CS
+;+10	rip
+;+08	errcode
+;+00	exp#
+;from user mode, leave per-core stack for kernel stack of this_thread
+;handlers may block and resume on other core
+test word [rsp+0x18],0x03	;CS
+jz .en_stack_ok
+swapgs
+push rsi
+push rdi
+push rcx
+mov rdi,[gs:8]	;this_thread
+lea rsi,[rsp+0x18]
+mov ecx,7
+mov rdi,[rdi+KSP_OFF]
+cld
+sub rdi,7*8
+rep movsq
+sub rdi,7*8
+mov rcx,rsp
+mov rsp,rdi
+mov rdi,[rcx+0x08]
+mov rsi,[rcx+0x10]
+mov rcx,[rcx]
+swapgs
+.en_stack_ok:
 
 ;+98	SS
 ;+90	rsp
@@ -196,6 +237,17 @@ xor rbx,rbx
 cmp rdx,rbp
 lea rdi,[rsp+0x20]
 jz .no_switch
+;leave stack of previous thread, then release it to other cores
+mov rsp,[gs:0x20]	;core_state::switch_stk
+mov [rbp+ONCORE_OFF],bl		;bl == 0
+.wait_core:
+cmp [rdx+ONCORE_OFF],bl
+jz .take_core
+pause
+jmp .wait_core
+.take_core:
+mov byte [rdx+ONCORE_OFF],1
+lea rdi,[rsp+0x20]
 lea rsi,[rdx+CONX_OFF+0x78]
 mov ecx,5
 mov rbp,rdx
@@ -351,7 +403,148 @@ hlt
 jmp .reboot
 
 
+;user memory access, faulting instruction resumes at fixup
+;see user_access_table & fixup_user_access in exception.cpp
+;rax <-- bytes left
+
+align 16
+; rcx dst
+; rdx sor
+; r8  length
+user_copy:
+push rsi
+push rdi
+mov rdi,rcx
+mov rsi,rdx
+mov rcx,r8
+.access:
+rep movsb
+.fixup:
+mov rax,rcx
+pop rdi
+pop rsi
+ret
+
+align 16
+; rcx dst
+; rdx length
+user_zero:
+push rdi
+mov rdi,rcx
+mov rcx,rdx
+xor eax,eax
+.access:
+rep stosb
+.fixup:
+mov rax,rcx
+pop rdi
+ret
+
+
 section .rdata
 align 16
 keycode:
-incbin 'keycode.bin'
\ No newline at end of file
+incbin 'keycode.bin'
+
+;pairs of faulting rip & fixup rip, zero terminated
+align 8
+user_access_table:
+dq user_copy.access, user_copy.fixup
+dq user_zero.access, user_zero.fixup
+dq 0
+
+;AP startup code, copied to AP_ENTRY_PBASE
+;SIPI enters in real mode with CS = AP_ENTRY_PBASE >> 4, IP = 0
+;identity map of AP_ENTRY_PBASE provided by BSP
+
+%define AP_OFF(x) ((x) - ap_trampoline)
+%define AP_ADDR(x) (AP_ENTRY_PBASE + AP_OFF(x))
+
+align 16
+ap_trampoline:
+[bits 16]
+cli
+cld
+mov ax,cs
+mov ds,ax
+lgdt [AP_OFF(ap_gdtr)]
+mov eax,cr0
+bts eax,0	;PE
+mov cr0,eax
+jmp dword 0x08:AP_ADDR(ap_protect)
+
+[bits 32]
+ap_protect:
+mov ax,0x10
+mov ds,ax
+mov es,ax
+mov ss,ax
+mov ebx,AP_ENTRY_PBASE
+
+mov eax,[ebx + AP_OFF(ap_info.cr4)]
+mov cr4,eax
+mov eax,[ebx + AP_OFF(ap_info.cr3)]
+mov cr3,eax
+
+mov ecx,0xC0000080	;IA32_EFER
+rdmsr
+or ax,0000_1001_0000_0001_b		;NXE LME SCE
+wrmsr
+
+;enable PG with the same CR0 as BSP
+mov eax,[ebx + AP_OFF(ap_info.cr0)]
+mov cr0,eax
+jmp 0x18:AP_ADDR(ap_long)
+
+[bits 64]
+ap_long:
+mov ebx,AP_ENTRY_PBASE
+lgdt [rbx + AP_OFF(ap_gdtr64)]
+lidt [rbx + AP_OFF(ap_idtr64)]
+mov ax,SEG_KRNL_SS
+mov ds,ax
+mov es,ax
+mov ss,ax
+xor eax,eax
+mov fs,ax
+mov gs,ax
+
+mov rsp,[rbx + AP_OFF(ap_info.stack)]
+mov rcx,[rbx + AP_OFF(ap_info.arg)]
+sub rsp,0x38	;shadow space & align as called
+push SEG_KRNL_CS
+push qword [rbx + AP_OFF(ap_info.entry)]
+o64 retf	;reload CS, never return
+
+align 8
+ap_gdt:
+dq 0
+dq 0x00CF9A000000FFFF	;code32
+dq 0x00CF92000000FFFF	;data32
+dq 0x00209A0000000000	;code64
+
+ap_gdtr:
+dw 4*8 - 1
+dd AP_ADDR(ap_gdt)
+
+align 8
+dw 0,0,0
+ap_gdtr64:
+dw GDT_LIM - 1
+dq GDT_BASE
+
+dw 0,0,0
+ap_idtr64:
+dw IDT_LIM - 1
+dq IDT_BASE
+
+;see struct ap_info in core_state.cpp
+align 8
+ap_info:
+.cr0	dq 0
+.cr3	dq 0
+.cr4	dq 0
+.entry	dq 0
+.stack	dq 0
+.arg	dq 0
+ap_trampoline_end:
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include "assert.hpp"
 #include "string.hpp"
 #include "service_code.hpp"
+#include "filesystem/include/file.hpp"
 
 using namespace UOS;
 
@@ -92,7 +93,12 @@ void UOS::process_loader(qword ptr,qword image_base,qword image_size,qword heade
 		this_thread->user_stk_reserved = stack_page_count*PAGE_SIZE;
 		this_thread->user_stk_top = stack_base + (1 + stack_page_count)*PAGE_SIZE;
 
-		//loads every section
+		//sections read from image file on first touch
+		assert(this_process->image_source == nullptr);
+		this_process->image_source = new file_source(f);
+		auto vspace = static_cast<user_vspace*>(this_process->vspace);
+
+		//maps every section
 		unsigned index = 0;
 		do{
 			auto section = this_process->image->get_section(index);
@@ -109,19 +115,23 @@ void UOS::process_loader(qword ptr,qword image_base,qword image_size,qword heade
 				break;
 			auto section_base = image_base + section->offset;
 			assert(0 == (section_base & PAGE_MASK));
-			if (!this_process->vspace->commit(section_base,section_page_count))
-				break;
-			if (section->datasize){
-				if (!f->seek(section->fileoffset))
-					break;
-				if (f->state() != 0 || f->tell() != section->fileoffset)
-					break;
-				f->read((void*)section_base,section->datasize);
-				f->wait();
-				if (f->state() != 0 || f->result() != section->datasize)
+			if (section->fileoffset & PAGE_MASK){
+				//not page aligned in file, load eagerly
+				if (!vspace->commit(section_base,section_page_count))
 					break;
+				if (section->datasize){
+					if (!f->seek(section->fileoffset))
+						break;
+					if (f->state() != 0 || f->tell() != section->fileoffset)
+						break;
+					f->read((void*)section_base,section->datasize);
+					f->wait();
+					if (f->state() != 0 || f->result() != section->datasize)
+						break;
+				}
 			}
-			zeromemory((void*)(section_base + section->datasize),section_page_count*PAGE_SIZE - section->datasize);
+			else if (!vspace->map_source(section_base,section_page_count,this_process->image_source,section->fileoffset,section->datasize))
+				break;
 			qword attrib = 0;
 			if (section->attrib & 0x80000000)
 				attrib |= PAGE_WRITE;
@@ -197,6 +207,8 @@ qword kernel_service(dword cmd,qword a1,qword a2,qword a3,qword rip,qword rsp){
 			return srv.get_time();
 		case enum_process:
 			return srv.enum_process(a1);
+		case get_clock:
+			return srv.get_clock();
 		case display_fill:
 			return srv.display_fill(a1,a2);
 		case display_draw:
@@ -240,6 +252,8 @@ qword kernel_service(dword cmd,qword a1,qword a2,qword a3,qword rip,qword rsp){
 			return srv.kill_process(a1,a2);
 		case process_result:
 			return srv.process_result(a1);
+		case set_share:
+			return srv.set_share(a1,a2);
 		case create_process:
 			return srv.create_process((void const*)a1,a2);
 		case open_process:
@@ -248,6 +262,8 @@ qword kernel_service(dword cmd,qword a1,qword a2,qword a3,qword rip,qword rsp){
 			return srv.get_work_dir((void*)a1,a2);
 		case set_work_dir:
 			return srv.set_work_dir((void const*)a1,a2);
+		case clone_process:
+			return srv.clone_process(a1,a2);
 		case handle_type:
 			return srv.handle_type(a1);
 		case open_handle:
@@ -256,6 +272,8 @@ qword kernel_service(dword cmd,qword a1,qword a2,qword a3,qword rip,qword rsp){
 			return srv.close_handle(a1);
 		case create_object:
 			return srv.create_object((OBJTYPE)a1,a2,a3);
+		case name_object:
+			return srv.name_object(a1,(void const*)a2,a3);
 		case vm_peek:
 			return srv.vm_peek(a1);
 		case vm_protect:
@@ -266,6 +284,10 @@ qword kernel_service(dword cmd,qword a1,qword a2,qword a3,qword rip,qword rsp){
 			return srv.vm_commit(a1,a2);
 		case vm_release:
 			return srv.vm_release(a1,a2);
+		case vm_map:
+			return srv.vm_map(a1,a2,a3);
+		case vm_sync:
+			return srv.vm_sync(a1,a2);
 		case stream_state:
 			return srv.stream_state(a1);
 		case stream_read:
@@ -288,6 +310,8 @@ qword kernel_service(dword cmd,qword a1,qword a2,qword a3,qword rip,qword rsp){
 			return srv.file_change(a1,a2);
 		case file_move:
 			return srv.file_move(a1,(void const*)a2,a3);
+		case file_map:
+			return srv.file_map(a1,a2,a3);
 	}
 	if (!user_exception(rip,rsp,ERROR_CODE::SV))
 		srv.exit_process(ERROR_CODE::SV);
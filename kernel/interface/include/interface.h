@@ -23,7 +23,7 @@ typedef enum : dword{
 } ERROR_CODE;
 typedef enum : byte {KERNEL = 0,SHELL = 0x20,NORMAL = 0x40} PRIVILEGE;
 typedef enum : byte {NONE = 0, PASSED = 1, NOTIFY = 2, TIMEOUT = 3, ABANDON = 4} REASON;
-typedef enum : dword {OBJ_UNKNOWN = 0,OBJ_THREAD,OBJ_PROCESS,OBJ_STREAM,OBJ_FILE,OBJ_PIPE,OBJ_SEMAPHORE,OBJ_EVENT} OBJTYPE;
+typedef enum : dword {OBJ_UNKNOWN = 0,OBJ_THREAD,OBJ_PROCESS,OBJ_STREAM,OBJ_FILE,OBJ_PIPE,OBJ_SEMAPHORE,OBJ_EVENT,OBJ_SECTION} OBJTYPE;
 typedef enum : byte {
 	// EOF_BIT = 1,
 	// FAIL_BIT = 2,
@@ -70,9 +70,48 @@ typedef struct {
 	qword used_memory;
 	word resolution_x;
 	word resolution_y;
-	dword reserved;
-	//system description follows
+	//count of CORE_INFO following
+	word core_info;
+	word reserved;
+	//CORE_INFO[core_info] follows, then system description
 } OS_INFO;
+typedef struct {
+	//gave up processor, i.e. waiting
+	qword switch_count;
+	//switched out while still ready
+	qword preempt_count;
+	//slices used up
+	qword slice_count;
+	//#NM traps for lazy FPU restore
+	qword fpu_trap;
+	//us spent in run queue
+	qword wait_time;
+} SCHED_STAT;
+typedef struct {
+	word uid;
+	word reserved;
+	//busy per mille since boot
+	dword load;
+	//us running idle thread
+	qword idle_time;
+	qword busy_time;
+	SCHED_STAT sched;
+} CORE_INFO;
+//mapped read-only at TIME_PAGE_BASE in every process
+#define TIME_PAGE_BASE ((qword)0x7FFFFFF000)
+typedef struct {
+	//odd while kernel updating
+	volatile dword sequence;
+	dword reserved;
+	qword running_us;
+	//POSIX time from RTC
+	qword wall_time;
+	//clock_ns when TSC reads tsc_base
+	qword clock_ns;
+	qword tsc_base;
+	//ns per TSC tick in 32.32, 0 if TSC not usable
+	qword tsc_mul;
+} TIME_PAGE;
 typedef struct {
 	dword id;
 	PRIVILEGE privilege;
@@ -82,6 +121,7 @@ typedef struct {
 	qword start_time;
 	qword cpu_time;
 	qword memory_usage;
+	SCHED_STAT sched;
 } PROCESS_INFO;
 typedef struct {
 	const char* commandline;
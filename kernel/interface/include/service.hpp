@@ -48,6 +48,7 @@ namespace UOS{
 		qword os_info(void* buffer,dword limit);
 		qword get_time(void);
 		qword enum_process(dword id);
+		qword get_clock(void);
 		STATUS display_fill(dword color,qword val);
 		STATUS display_draw(void const* buffer,qword val,word advance);
 		HANDLE get_thread(void);
@@ -71,19 +72,24 @@ namespace UOS{
 		void exit_process(dword result);
 		STATUS kill_process(HANDLE handle,dword result);
 		qword process_result(HANDLE handle);
+		STATUS set_share(HANDLE handle,dword share);
 		qword create_process(void const* info,dword length);
 		qword open_process(dword id);
 		qword get_work_dir(void* buffer,dword limit);
 		STATUS set_work_dir(void const* buffer,dword length);
+		qword clone_process(qword entry,qword arg);
 		OBJTYPE handle_type(HANDLE handle);
 		qword open_handle(void const* name,dword length);
 		STATUS close_handle(HANDLE handle);
 		qword create_object(OBJTYPE type,qword a1,qword a2);
+		STATUS name_object(HANDLE handle,void const* name,dword length);
 		qword vm_peek(qword va);
 		STATUS vm_protect(qword va,dword count,qword attrib);
 		qword vm_reserve(qword va,dword count);
 		STATUS vm_commit(qword va,dword count);
 		STATUS vm_release(qword va,dword count);
+		qword vm_map(HANDLE handle,qword va,dword count);
+		STATUS vm_sync(qword va,dword count);
 		qword stream_state(HANDLE handle);
 		qword stream_read(HANDLE handle,void* buffer,dword limit);
 		qword stream_write(HANDLE handle,void const* buffer,dword length);
@@ -95,5 +101,6 @@ namespace UOS{
 		qword file_info(HANDLE handle,void* buffer,dword limit);
 		STATUS file_change(HANDLE handle,dword attrib);
 		STATUS file_move(HANDLE handle,void const* target,dword length);
+		qword file_map(HANDLE handle,qword va,dword count);
 	};
 }
\ No newline at end of file
@@ -7,6 +7,7 @@ namespace UOS{
 		os_info			= 0x0008,
 		get_time		= 0x000C,
 		enum_process	= 0x0010,
+		get_clock		= 0x0014,
 		display_fill	= 0x0020,
 		display_draw	= 0x0028,
 		get_thread		= 0x0100,
@@ -28,19 +29,24 @@ namespace UOS{
 		exit_process	= 0x0210,
 		kill_process	= 0x0214,
 		process_result	= 0x0218,
+		set_share		= 0x021C,
 		create_process	= 0x0220,
 		open_process	= 0x0224,
 		get_work_dir	= 0x0228,
 		set_work_dir	= 0x022C,
+		clone_process	= 0x0230,
 		handle_type		= 0x0300,
 		open_handle		= 0x0304,
 		close_handle	= 0x0308,
 		create_object	= 0x030C,
+		name_object		= 0x0310,
 		vm_peek			= 0x0400,
 		vm_protect		= 0x0408,
 		vm_reserve		= 0x0410,
 		vm_commit		= 0x0414,
 		vm_release		= 0x041C,
+		vm_map			= 0x0420,
+		vm_sync			= 0x0424,
 		stream_state	= 0x0500,
 		stream_read		= 0x0508,
 		stream_write	= 0x050C,
@@ -52,5 +58,6 @@ namespace UOS{
 		file_info		= 0x0614,
 		file_change		= 0x0618,
 		file_move		= 0x061C,
+		file_map		= 0x0620,
 	};
 }
\ No newline at end of file
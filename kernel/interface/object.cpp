@@ -11,15 +11,22 @@ bool object_manager::put(literal&& name,waitable* obj,dword properties){
 	{
 		this_core core;
 		auto this_process = core.this_thread()->get_process();
-		if (this_process->get_privilege() < (byte)properties)
+		//cannot restrict above own privilege
+		if ((byte)properties < this_process->get_privilege())
 			return false;
 	}
 	interrupt_guard<rwlock> guard(objlock);
 	auto it = table.find(name);
-	if (it == table.end())
+	if (it != table.end())
 		return false;
+	//one name per object, erase drops every entry of it
+	for (it = table.begin();it != table.end();++it){
+		if (obj == it->obj)
+			return false;
+	}
 	table.insert(move(name),obj,properties);
-	obj->manage();
+	//marks named, no reference taken
+	obj->manage(this);
 	return true;
 }
 
@@ -37,10 +44,11 @@ void object_manager::erase(waitable* obj){
 	{
 		interrupt_guard<rwlock> guard(objlock);
 		auto it = table.begin();
-		for (;it != table.end();++it){
-			if (obj == it->obj){
+		while(it != table.end()){
+			if (obj == it->obj)
 				it = table.erase(it);
-			}
+			else
+				++it;
 		}
 	}
 }
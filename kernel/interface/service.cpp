@@ -12,6 +12,7 @@
 #include "sync/include/semaphore.hpp"
 #include "sync/include/event.hpp"
 #include "sync/include/pipe.hpp"
+#include "sync/include/section.hpp"
 
 using namespace UOS;
 
@@ -49,9 +50,24 @@ bool service_provider::check(void const* ptr,dword length,bool write){
 	}
 	auto va = reinterpret_cast<qword>(ptr);
 	auto tail = va + length;
-	va = align_down(va,PAGE_SIZE);
+	if (tail < va)
+		return false;
+	//user vspace is current here, walk through PT window
+	user_vspace* uvs = (vspace == &vm) ? nullptr : static_cast<user_vspace*>(vspace);
+	auto& cache = this_thread->checked;
+	if (uvs){
+		//mappings only removed or downgraded with vspace locked exclusively, which moves generation
+		if (cache.gen == uvs->generation() && va >= cache.base && tail <= cache.top && (cache.write || !write))
+			return true;
+	}
+	auto base = align_down(va,PAGE_SIZE);
+	va = base;
 	while(va < tail){
-		auto pt = vspace->peek(va);
+		auto pt = uvs ? uvs->peek_local(va) : vspace->peek(va);
+		if (pt.lazy() && vspace->fault_in(va))
+			pt = uvs ? uvs->peek_local(va) : vspace->peek(va);
+		if (write && pt.cow() && vspace->copy_on_write(va))
+			pt = uvs ? uvs->peek_local(va) : vspace->peek(va);
 		if (!pt.present || !pt.user){
 			return false;
 		}
@@ -61,6 +77,12 @@ bool service_provider::check(void const* ptr,dword length,bool write){
 		va += PAGE_SIZE;
 	}
 	assert(0 == (tail & HIGHADDR(0)));
+	if (uvs){
+		cache.base = base;
+		cache.top = va;
+		cache.gen = uvs->generation();
+		cache.write = write;
+	}
 	return true;
 }
 
@@ -133,14 +155,14 @@ qword service_provider::osctl(osctl_code cmd,void* buffer,dword length){
 qword service_provider::os_info(void* buffer,dword limit){
 	if (!check(buffer,limit,true))
 		return BAD_BUFFER;
-	auto size = sizeof(OS_INFO) + sizeof(COFUOS_DESCRIPTION);
+	auto core_count = cores.capacity();
+	auto size = sizeof(OS_INFO) + core_count*sizeof(CORE_INFO) + sizeof(COFUOS_DESCRIPTION);
 	if (limit < sizeof(OS_INFO))
 		return pack_qword(TOO_SMALL,size);
 	auto info = (OS_INFO*)buffer;
 	info->version = COFUOS_VERSION;
 	info->features = 0;	//TODO
 	info->active_core = cores.size();
-	//TODO info->cpu_load
 	info->process_count = proc.size();
 	info->running_time = timer.running_time();
 	info->total_memory = PAGE_SIZE*pm.capacity();
@@ -148,9 +170,37 @@ qword service_provider::os_info(void* buffer,dword limit){
 	info->resolution_x = display.get_width();
 	info->resolution_y = display.get_height();
 	info->reserved = 0;
-	if (limit < size)
+	//racy snapshot of per-core counters
+	qword total_idle = 0;
+	qword total_busy = 0;
+	auto core_info = (CORE_INFO*)(info + 1);
+	bool fill = (limit >= size);
+	for (unsigned i = 0;i < core_count;++i){
+		auto core = cores.at(i);
+		qword idle = core ? core->idle_time : 0;
+		qword busy = core ? core->busy_time : 0;
+		total_idle += idle;
+		total_busy += busy;
+		if (!fill)
+			continue;
+		auto& cur = core_info[i];
+		cur.uid = core ? core->uid : 0;
+		cur.reserved = 0;
+		cur.load = (idle + busy) ? (busy*1000/(idle + busy)) : 0;
+		cur.idle_time = idle;
+		cur.busy_time = busy;
+		if (core)
+			cur.sched = core->stat;
+		else
+			zeromemory(&cur.sched,sizeof(SCHED_STAT));
+	}
+	info->cpu_load = (total_idle + total_busy) ? (total_busy*1000/(total_idle + total_busy)) : 0;
+	if (!fill){
+		info->core_info = 0;
 		return pack_qword(SUCCESS,sizeof(OS_INFO));
-	memcpy(info + 1,COFUOS_DESCRIPTION,sizeof(COFUOS_DESCRIPTION));
+	}
+	info->core_info = core_count;
+	memcpy(core_info + core_count,COFUOS_DESCRIPTION,sizeof(COFUOS_DESCRIPTION));
 	return pack_qword(SUCCESS,size);
 }
 qword service_provider::get_time(void){
@@ -160,6 +210,9 @@ qword service_provider::enum_process(dword id){
 	auto res = proc.enumerate(id);
 	return pack_qword(res ? SUCCESS : FAILED,id);
 }
+qword service_provider::get_clock(void){
+	return timer.clock_ns();
+}
 STATUS service_provider::display_fill(dword color,qword val){
 	if (this_process->get_privilege() > SHELL)
 		return DENIED;
@@ -340,6 +393,7 @@ qword service_provider::process_info(HANDLE handle,void* buffer,dword limit){
 	info->start_time = ps->start_time;
 	info->cpu_time = ps->cpu_time;
 	info->memory_usage = ps->vspace->usage()*PAGE_SIZE;
+	info->sched = ps->stat;
 	return pack_qword(SUCCESS,sizeof(PROCESS_INFO));
 }
 qword service_provider::get_command(HANDLE handle,void* buffer,dword limit){
@@ -380,6 +434,17 @@ qword service_provider::process_result(HANDLE handle){
 		return FAILED;
 	return pack_qword(SUCCESS,result);
 }
+STATUS service_provider::set_share(HANDLE handle,dword share){
+	auto ps = static_cast<process*>(get(handle,OBJ_PROCESS));
+	if (ps == nullptr)
+		return BAD_HANDLE;
+	if (share > scheduler::max_share)
+		return BAD_PARAM;
+	if (share > scheduler::default_share && this_process->get_privilege() > SHELL)
+		return DENIED;
+	ps->share = share;
+	return SUCCESS;
+}
 qword service_provider::create_process(void const* ptr,dword length){
 	if (!check(ptr,length) || length < sizeof(STARTUP_INFO))
 		return BAD_BUFFER;
@@ -474,6 +539,24 @@ STATUS service_provider::set_work_dir(const void* buffer,dword length){
 		return BAD_PARAM;
 	return this_process->set_work_dir(span<char>((const char*)buffer,length)) ? SUCCESS : FAILED;
 }
+qword service_provider::clone_process(qword entry,qword arg){
+	if (entry & HIGHADDR(0))
+		return BAD_PARAM;
+	//vspace locked exclusively while cloning
+	assert(!hold_memory);
+	if (hold_handle){
+		this_process->handles.unlock();
+		hold_handle = false;
+	}
+	auto ps = proc.clone(entry,arg);
+	if (ps == nullptr)
+		return NO_RESOURCE;
+	HANDLE handle = this_process->handles.put(ps);
+	if (handle)
+		return pack_qword(SUCCESS,handle);
+	ps->relax();
+	return NO_RESOURCE;
+}
 OBJTYPE service_provider::handle_type(HANDLE handle){
 	auto obj = get(handle);
 	if (obj == nullptr)
@@ -522,6 +605,14 @@ qword service_provider::create_object(OBJTYPE type,qword a1,qword a2){
 			if (a1 >= 0x10)
 				ptr = new pipe(a1,a2);
 			break;
+		case OBJ_SECTION:
+			//a1 as page count
+			if (a1 <= section::max_count){
+				ptr = section::create(a1);
+				if (!ptr)
+					return NO_RESOURCE;
+			}
+			break;
 		default:
 			break;
 	}
@@ -534,6 +625,27 @@ qword service_provider::create_object(OBJTYPE type,qword a1,qword a2){
 	ptr->relax();
 	return NO_RESOURCE;
 }
+STATUS service_provider::name_object(HANDLE handle,void const* name,dword length){
+	if (length == 0 || length >= object_manager::max_name_length)
+		return BAD_PARAM;
+	if (!check(name,length))
+		return BAD_BUFFER;
+	auto obj = get(handle);
+	if (obj == nullptr)
+		return BAD_HANDLE;
+	switch(obj->type()){
+		case OBJ_PIPE:
+		case OBJ_SEMAPHORE:
+		case OBJ_EVENT:
+		case OBJ_SECTION:
+			break;
+		default:
+			return BAD_HANDLE;
+	}
+	//open to every process
+	auto ptr = (char const*)name;
+	return named_obj.put(literal(ptr,ptr + length),obj,NORMAL) ? SUCCESS : DENIED;
+}
 qword service_provider::vm_peek(qword va){
 	constexpr qword mask = 0x800000000000007B;
 	auto pt = vspace->peek(va);
@@ -546,7 +658,7 @@ qword service_provider::vm_reserve(qword va,dword count){
 	return vspace->reserve(va,count);
 }
 STATUS service_provider::vm_commit(qword va,dword count){
-	auto res = vspace->commit(va,count);
+	auto res = vspace->commit_lazy(va,count);
 	if (res)
 		return SUCCESS;
 	if (pm.capacity() - pm.available() <= pm.get_critical_limit())
@@ -554,8 +666,28 @@ STATUS service_provider::vm_commit(qword va,dword count){
 	return BAD_PARAM;
 }
 STATUS service_provider::vm_release(qword va,dword count){
+	//file mapped pages written back before unmapped
+	if (vspace != &vm)
+		static_cast<user_vspace*>(vspace)->sync(va,count);
 	return vspace->release(va,count) ? SUCCESS : BAD_PARAM;
 }
+qword service_provider::vm_map(HANDLE handle,qword va,dword count){
+	auto obj = get(handle,OBJ_SECTION);
+	if (obj == nullptr || vspace == &vm || !obj->acquire())
+		return 0;
+	//vspace locked exclusively while mapping, never under handle lock
+	assert(!hold_memory && hold_handle);
+	this_process->handles.unlock();
+	hold_handle = false;
+	auto res = static_cast<section*>(obj)->map(*static_cast<user_vspace*>(vspace),va,count);
+	obj->relax();
+	return res;
+}
+STATUS service_provider::vm_sync(qword va,dword count){
+	if (vspace == &vm)
+		return BAD_PARAM;
+	return static_cast<user_vspace*>(vspace)->sync(va,count) ? SUCCESS : FAILED;
+}
 qword service_provider::stream_state(HANDLE handle){
 	auto obj = get(handle,OBJ_STREAM);
 	if (obj == nullptr)
@@ -653,4 +785,35 @@ STATUS service_provider::file_change(HANDLE handle,dword attrib){
 }
 STATUS service_provider::file_move(HANDLE handle,const void* target,dword length){
 	bugcheck("file_move not implemented");
+}
+qword service_provider::file_map(HANDLE handle,qword va,dword count){
+	auto obj = get(handle,OBJ_FILE);
+	if (obj == nullptr || vspace == &vm || count == 0)
+		return 0;
+	auto f = static_cast<file*>(obj);
+	//mapped from current offset, content beyond file size zeroed
+	auto offset = f->tell();
+	auto size = f->size();
+	if ((offset & PAGE_MASK) || offset >= size)
+		return 0;
+	auto length = min<qword>(size - offset,(qword)count*PAGE_SIZE);
+	auto source = new file_source(f);
+	//vspace locked exclusively while mapping, never under handle lock
+	assert(!hold_memory && hold_handle);
+	this_process->handles.unlock();
+	hold_handle = false;
+	auto uvs = static_cast<user_vspace*>(vspace);
+	bool reserved = false;
+	if (va == 0){
+		va = uvs->reserve(0,count);
+		reserved = (va != 0);
+	}
+	if (va && !uvs->map_source(va,count,source,offset,length)){
+		if (reserved)
+			uvs->release(va,count);
+		va = 0;
+	}
+	//referenced by vspace if mapped
+	source->relax();
+	return va;
 }
\ No newline at end of file
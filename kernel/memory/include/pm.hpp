@@ -11,14 +11,42 @@ namespace UOS{
 		typedef dword (*critical_callback)(PM&,void*);
 		enum MODE {NONE = 0,MUST_SUCCEED,TAKE};
 	private:
+		//64-way bitmap levels, covers 2^36 pages
+		static constexpr unsigned max_level = 6;
+		static constexpr word max_magazine = 0x40;
+		static constexpr word zero_pool_size = 0x100;
+		//non-empty words probed for a run before allocate_batch takes single pages
+		static constexpr qword run_scan_limit = 0x40;
+
+		//per-core cache of free pages, refilled & drained by half
+		struct alignas(0x40) magazine{
+			spin_lock lock;
+			word count;
+			qword page[max_magazine];
+		};
+
 		spin_lock lock;
 		word soft_critical_limit;
 		word hard_critical_limit;
+		//level 0 has one bit per page, set as free
+		//bit in upper levels set if corresponding lower qword non-zero
+		byte level_count;
+		qword level_offset[max_level];
+		//level 0 word after last run taken, see take_run
+		qword run_hint;
 		qword bmp_size;
+		qword bmp_pages;
 		qword total;
-		qword used;
-		qword reserved;
-		qword next;
+		//lock_add outside of lock, hard_critical_limit covers the race
+		volatile qword used;
+		volatile qword reserved;
+		//indexed by this_core::index, nullptr before set_mp_count
+		magazine* mag_list;
+		word mag_size;
+		//pre-zeroed pages filled by zero_service, free in accounting
+		spin_lock zero_lock;
+		volatile word zero_count;
+		qword zero_list[zero_pool_size];
 
 		critical_callback callback;
 		void* userdata;
@@ -28,13 +56,52 @@ namespace UOS{
 		void check_integrity(void);
 #endif
 		void critical_check(void);
+		//IF == 0, nullptr if not available
+		magazine* local_magazine(void);
+		//lock-free check & update of reserved, IF == 0
+		bool quota(qword count,MODE mode);
+		//lock held, 0 if used up
+		qword take_page(void);
+		//lock held, run of 'count' free pages from run_hint, 0 if none
+		//'align' in pages, multiple of 0x40 if not 1
+		//gives up after 'limit' non-empty words when not aligned
+		qword take_run(dword count,dword align = 1,qword limit = ~(qword)0);
+		//page of first run in words [from,to), ~0 if none
+		qword find_run(qword from,qword to,dword count,qword& limit) const;
+		//level 0 word of first aligned run in [from,to), ~0 if none
+		qword find_aligned(qword from,qword to,qword need,qword step) const;
+		//lock held, first non-empty level 0 word from 'index', found through upper levels
+		qword next_word(qword index) const;
+		void mark_used(qword page);
+		void put_page(qword pa);
+		//mag->lock held
+		void refill(magazine& mag);
+		void drain(magazine& mag);
+		//IF == 0, no magazine locked
+		qword steal(void);
 	public:
 		PM(void);
 		qword allocate(MODE = NONE);
+		//fills 'out' with 'count' pages in one lock hold, contiguous if possible
+		//zeroed pages drawn from zero pool first, rest cleared in place
+		//returns 'count', or 0 if quota exceeded
+		dword allocate_batch(dword count,qword* out,MODE = NONE,bool zeroed = false);
+		//physically contiguous, 0 if no such run
+		qword allocate_contiguous(dword count,MODE = NONE,dword align = 1);
+		//zeroed 2M aligned run of 0x200 pages for large page, 0 if none
+		qword allocate_large(MODE = NONE);
 		void release(qword);
 		bool reserve(dword page_count);
+		//gives back reservation not taken
+		void unreserve(dword page_count);
 		void set_mp_count(dword);
 		void set_critical_callback(critical_callback cb,void* ud);
+		//for zero_service, 0 if pool full or memory critical
+		qword zero_pick(void);
+		void zero_put(qword pa);
+		inline bool zero_low(void) const{
+			return zero_count < zero_pool_size/2;
+		}
 
 		inline qword capacity(void) const{
 			return total;
@@ -47,7 +114,7 @@ namespace UOS{
 			return soft_critical_limit;
 		}
 		inline qword bmp_page_count(void) const{
-			return align_up(bmp_size,PAGE_SIZE) >> 12;
+			return bmp_pages;
 		}
 
 		static bool peek(void* dest,qword paddr,size_t count);
@@ -5,17 +5,32 @@
 #include "pm.hpp"
 #include "constant.hpp"
 #include "sync/include/rwlock.hpp"
+#include "vector.hpp"
+#include "hash.hpp"
+#include "hash_set.hpp"
+#include "intrinsics.hpp"
 
 namespace UOS{
 	class map_view{
 		void* view = nullptr;
+		dword count = 0;
+		//other views of the holder thread, see thread::views
+		map_view* next = nullptr;
 		void unmap(void);
 	public:
+		//pages in one view, slots found in a single window
+		static constexpr dword max_count = 0x10;
+		//drops entries of views in 'list' on this core, CR3 of their holder loaded
+		static void invalidate(const map_view* list);
+
 		map_view(void) = default;
 		map_view(qword pa,qword attrib = PAGE_XD | PAGE_WRITE);
+		//frames in 'pa_list' mapped virtually contiguous
+		map_view(const qword* pa_list,dword count,qword attrib = PAGE_XD | PAGE_WRITE);
 		map_view(const map_view&) = delete;
 		~map_view(void);
 		void map(qword pa,qword attrib = PAGE_XD | PAGE_WRITE);
+		void map(const qword* pa_list,dword count,qword attrib = PAGE_XD | PAGE_WRITE);
 		template<typename T>
 		inline operator T*(void) const{
 			return (T*)view;
@@ -23,6 +38,12 @@ namespace UOS{
 
 	};
 
+	//direct access to user memory of active address space, faults fixed up
+	//returns bytes transferred, stops at first inaccessible byte
+	dword copy_to_user(void* dst,const void* sor,dword length);
+	dword copy_from_user(void* dst,const void* sor,dword length);
+	dword zero_user(void* dst,dword length);
+
 	struct PTE {
 		qword present : 1;
 		qword write : 1;
@@ -35,6 +56,9 @@ namespace UOS{
 		qword global : 1;
 		//UOS_defined {
 		enum : qword {OFF, SIZE, PREV, NEXT} type : 2;
+		//free block: link valid; preserve && !present: commit on fault
+		//present: frame shared with other vspaces, see shared() & cow()
+		//present && !valid && data: private copy of source page, see user_vspace::sync
 		qword valid : 1;
 		// }
 		qword page_addr : 40;
@@ -51,6 +75,23 @@ namespace UOS{
 		qword bypass : 1;
 		// }
 		qword xd : 1;
+
+		//reserved with capacity in PM, frame allocated on first touch
+		inline bool lazy(void) const{
+			return preserve && valid && !present;
+		}
+		//read-only frame referenced from page_source, data holds region index + 1
+		inline bool shared(void) const{
+			return present && valid && data;
+		}
+		//writable frame referenced in cow_table, copied on first write
+		inline bool cow(void) const{
+			return present && valid && !data;
+		}
+		//lazy, shared or private page counted in its source region
+		inline bool sourced(void) const{
+			return data && !bypass && (present || (preserve && valid));
+		}
 	};
 
 	/*
@@ -60,6 +101,9 @@ namespace UOS{
 		{NEXT PREV SIZE}
 		{NEXT PREV SIZE OFF...}
 		Free blocks linked, ordered by size, ascending
+
+		PDTE with ps set maps a 2M page, pt_addr holds its frame
+		page table freed with capacity kept reserved, see imp_merge & imp_split
 	*/
 
 	struct PDTE {
@@ -71,13 +115,16 @@ namespace UOS{
 		qword accessed : 1;
 		qword : 1;
 		qword ps : 1;
+		//G bit of 2M page, clear otherwise as PT window maps table with PDTE as PTE
+		qword global : 1;
 		//UOS_defined {
-		qword remain : 4;
+		//low bits of max free size, see get_max_size
+		qword remain : 3;
 		// }
 		qword pt_addr : 40;
 		//UOS_defined {
 		qword head : 9;
-		qword : 1;
+		qword remain_hi : 1;
 		qword bypass : 1;
 		// }
 		qword xd : 1;
@@ -99,6 +146,69 @@ namespace UOS{
 	static_assert(sizeof(PTE) == 8,"PTE size mismatch");
 	static_assert(sizeof(PDTE) == 8,"PDTE size mismatch");
 	static_assert(sizeof(PDPTE) == 8,"PDPTE size mismatch");
+	//content of file backed pages, see user_vspace::map_source
+	class page_source{
+		spin_lock objlock;
+		dword ref_count = 1;
+	public:
+		virtual ~page_source(void) = default;
+		//referenced by each vspace mapping it
+		void acquire(void);
+		void relax(void);
+		//fills 'length' bytes at 'offset' into kernel buffer 'page', may sleep
+		virtual bool fill(qword offset,void* page,dword length) = 0;
+		//referenced read-only frame of page at 'offset', 0 if not shareable, may sleep
+		virtual qword share(qword offset,dword length){
+			return 0;
+		}
+		//drops reference taken by 'share'
+		virtual void unshare(qword offset,qword pa){
+			bugcheck("page_source::unshare not implemented (%x,%x)",offset,pa);
+		}
+		//frames from 'share' mapped as is on writable pages, writes seen by every vspace
+		virtual bool writable(void) const{
+			return false;
+		}
+		//writes 'length' bytes of kernel buffer 'page' back at 'offset', may sleep
+		virtual bool flush(qword offset,const void* page,dword length){
+			return false;
+		}
+	};
+
+	//reference count of frames mapped copy-on-write, see user_vspace::clone
+	//frame not in table has single owner, PM capacity reserved for each extra reference
+	class cow_table{
+		struct entry{
+			qword pa;
+			dword count;
+
+			entry(qword pa,dword count) : pa(pa), count(count) {}
+		};
+		struct hash{
+			UOS::hash<qword> h;
+			qword operator()(const entry& obj){
+				return h(obj.pa);
+			}
+			qword operator()(qword pa){
+				return h(pa);
+			}
+		};
+		struct equal{
+			bool operator()(const entry& obj,qword pa){
+				return obj.pa == pa;
+			}
+		};
+		spin_lock objlock;
+		hash_set<entry,hash,equal> table;
+	public:
+		//adds reference, capacity reserved by caller
+		void acquire(qword pa);
+		//drops reference, frame released with last one
+		void relax(qword pa);
+		//drops reference, returns frame for exclusive use, copied if still referenced
+		qword take(qword pa);
+	};
+
 	class virtual_space{
 	public:
 		static constexpr qword size_512G = 0x008000000000ULL;
@@ -112,9 +222,24 @@ namespace UOS{
 		virtual qword get_cr3(void) const = 0;
 		virtual qword reserve(qword addr,dword page_count) = 0;
 		virtual bool commit(qword addr,dword page_count) = 0;
+		//eager unless overridden
+		virtual bool commit_lazy(qword addr,dword page_count){
+			return commit(addr,page_count);
+		}
+		//maps frame for lazy page at 'va', false if not lazy
+		virtual bool fault_in(qword va){
+			return false;
+		}
+		//private copy of copy-on-write page at 'va', false if not writable
+		virtual bool copy_on_write(qword va){
+			return false;
+		}
 		virtual bool protect(qword addr,dword page_count,qword attrib) = 0;
 		virtual bool release(qword addr,dword page_count) = 0;
 
+		//loaded in CR3 of this core
+		bool is_current(void) const;
+
 		virtual dword write(qword va,const void* data,dword length);
 		virtual dword read(qword va,void* buffer,dword length);
 		virtual dword zero(qword va,dword length);
@@ -135,6 +260,12 @@ namespace UOS{
 		void imp_release(PDTE& pdt,PTE* table,qword base_addr,word count);
 		dword imp_iterate(const PDPTE* pdpt,qword base_addr,dword page_count,PTE_CALLBACK callback,qword data = 0);
 		PTE imp_peek(qword va,PDPTE const* pdpt_table);
+		//2M page seen as PTE of page 'index' within it
+		static PTE large_entry(const PDTE& pdt,word index);
+		//back to page table with same mappings, 'view' maps the table
+		void imp_split(PDTE& pdt,map_view& view);
+		//2M page if all entries map one aligned run with same attributes
+		bool imp_merge(PDTE& pdt,const PTE* table,qword base_addr);
 	protected:
 		//generic helper methods
 		bool new_pdt(PDPTE& pdpt,map_view& view);
@@ -143,6 +274,12 @@ namespace UOS{
 		qword reserve_any(PDPTE* pdpt_table,dword page_count);
 		qword reserve_big(PDPTE* pdpt_table,dword page_count);
 		bool safe_release(PDPTE* pdpt_table,qword addr,dword page_count);
+		//maps zeroed pages in batches, pages reserved in PM by caller
+		//aligned 2M ranges mapped as large pages if possible
+		void commit_reserved(const PDPTE* pdpt_table,qword addr,dword page_count,bool user);
+		//maps run from PM::allocate_large to reserved 2M range at 'addr'
+		void commit_large(const PDPTE* pdpt_table,qword addr,qword pa,bool user);
+		bool promote(const PDPTE* pdpt_table,qword addr);
 
 
 		struct BLOCK{	//see struct PTE
@@ -210,14 +347,73 @@ namespace UOS{
 		rwlock objlock;
 		const qword cr3;
 		const qword pl4te;
+		//never reused, keys PCID cache of each core
+		const qword uid;
+		//bumped when mappings removed or changed, cached PCID flushed on next switch
+		volatile qword tlb_gen = 0;
+
+		//serializes fault_in & copy_on_write under shared objlock
+		rwlock fault_lock;
+		struct source_region{
+			//nullptr when slot free
+			page_source* source;
+			qword base;
+			qword offset;
+			qword length;
+			//PTEs referring to this region, see PTE::sourced
+			dword pages;
+		};
+		//indexed by PTE::data - 1, slot freed with its last page
+		static constexpr dword max_region = 0x1FF;
+		vector<source_region> regions;
+
+		struct clone_tag {};
+		//empty lower half, filled by clone
+		user_vspace(clone_tag);
 
 		static bool common_check(qword addr,dword page_count);
+		//returns frame shared with other vspaces, PTE left as reserved page
+		void imp_unshare(PTE& pt,qword va);
+		//frame 'pa' once mapped at 'va', 'data' as in PTE, cow frame if 0
+		void imp_unshare(qword va,qword pa,qword data);
+		//frames unmapped by release, returned after TLB shootdown
+		struct retire_list{
+			static constexpr dword limit = 0x20;
+			dword count;
+			struct{
+				qword va;
+				qword pa;
+				word data;
+				bool shared;
+				bool sourced;
+			} list[limit];
+		};
+		void imp_retire(retire_list& retire);
+		//frames of accessible pages from 'va' into 'list', stops at first failure
+		//lazy & copy-on-write page resolved if first, objlock held
+		dword imp_gather(qword va,dword page_count,qword* list,bool write);
+		bool imp_commit_lazy(qword addr,dword page_count,page_source* source,qword offset,qword length);
+		//page of region 'data' - 1 released, source relaxed with the last one
+		void imp_unref(qword data);
+		inline void imp_stale(void){
+			lock_add(&tlb_gen,(qword)1);
+		}
+		static qword new_uid(void);
 	public:
 		user_vspace(void);
 		~user_vspace(void);
 		qword get_cr3(void) const override;
+		inline qword id(void) const{
+			return uid;
+		}
+		inline qword generation(void) const{
+			return tlb_gen;
+		}
 		qword reserve(qword addr,dword page_count) override;
 		bool commit(qword addr,dword page_count) override;
+		bool commit_lazy(qword addr,dword page_count) override;
+		bool fault_in(qword va) override;
+		bool copy_on_write(qword va) override;
 		bool protect(qword addr,dword page_count,qword attrib) override;
 		bool release(qword addr,dword page_count) override;
 
@@ -226,6 +422,20 @@ namespace UOS{
 		dword zero(qword va,dword length) override;
 
 		PTE peek(qword va) override;
+		//peek through PT window without mapping, vspace current & locked
+		PTE peek_local(qword va) const;
+		//commit lazily, filled from 'source' on fault, zero beyond 'length'
+		//'source' acquired until its last page released
+		bool map_source(qword addr,dword page_count,page_source* source,qword offset,qword length);
+		//writes modified pages mapped from source back through page_source::flush, may sleep
+		bool sync(qword addr,dword page_count);
+		//sync on every source region, before process exits
+		bool sync(void);
+		//map kernel owned pages read-only, not released with vspace
+		bool assign(qword va,qword pa,dword page_count);
+		//copy of this vspace, writable pages shared copy-on-write
+		//nullptr if out of memory
+		user_vspace* clone(void);
 		bool try_lock(void) override{
 			return objlock.try_lock(rwlock::SHARED);
 		}
@@ -244,4 +454,5 @@ namespace UOS{
 		}
 	};
 	extern kernel_vspace vm;
+	extern cow_table cow_frames;
 }
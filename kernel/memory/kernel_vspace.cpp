@@ -6,6 +6,7 @@
 #include "assert.hpp"
 #include "lock_guard.hpp"
 #include "sysinfo.hpp"
+#include "process/include/core_state.hpp"
 
 using namespace UOS;
 
@@ -75,7 +76,30 @@ kernel_vspace::kernel_vspace(void){
 	assert(krnl_index < 0x200 && pdt_table[krnl_index].present);
 	pdt_table[krnl_index].bypass = 1;
 	used_pages = pm.capacity() - pm.available();
+	//kernel half shared by every address space, kept across CR3 switch
+	{
+		map_view pt_view;
+		for (unsigned i = 0;i < 0x200;++i){
+			const auto& cur = pdt_table[i];
+			if (!cur.present || cur.ps)
+				continue;
+			pt_view.map(cur.pt_addr << 12);
+			auto table = (PTE*)pt_view;
+			for (unsigned k = 0;k < 0x200;++k){
+				if (table[k].present)
+					table[k].global = 1;
+			}
+		}
+	}
 	features.set(decltype(features)::MEM);
+	dword regs[4];
+	//user vspace tagged with PCID, see this_core::irq_switch_to
+	cpuid(1,0,regs);
+	if (regs[2] & (1 << 17)){
+		assert(0 == (read_cr3() & PAGE_MASK));
+		write_cr4(read_cr4() | (1 << 17));	//PCIDE
+		features.set(decltype(features)::PCID);
+	}
 	int_trap(3);
 }
 
@@ -127,18 +151,28 @@ qword kernel_vspace::reserve(qword addr,dword page_count){
 bool kernel_vspace::release(qword addr,dword page_count){
 	if (!common_check(addr,page_count))
 		return false;
-	interrupt_guard<spin_lock> guard(objlock);
-	auto res = imp_iterate(pdpt_table,addr,page_count,[](PTE& pt,qword,qword) -> bool{
-		if (pt.bypass)
+	qword mapped = 0;
+	{
+		interrupt_guard<spin_lock> guard(objlock);
+		auto res = imp_iterate(pdpt_table,addr,page_count,[](PTE& pt,qword,qword data) -> bool{
+			if (pt.bypass)
+				return false;
+			if (pt.present){
+				++*reinterpret_cast<qword*>(data);
+				return (pt.page_addr && !pt.user);
+			}
+			return pt.preserve;
+		},reinterpret_cast<qword>(&mapped));
+		if (res != page_count)
 			return false;
-		if (pt.present){
-			return (pt.page_addr && !pt.user);
-		}
-		return pt.preserve;
-	});
-	if (res != page_count)
-		return false;
-	return safe_release(pdpt_table,addr,page_count);
+		if (!safe_release(pdpt_table,addr,page_count))
+			return false;
+	}
+	//global entries of released range may live on other cores
+	//never-committed range skips it, heap expansion releases under heap lock
+	if (mapped)
+		cores.shootdown();
+	return true;
 }
 
 bool kernel_vspace::commit(qword base_addr,dword page_count){
@@ -158,18 +192,7 @@ bool kernel_vspace::commit(qword base_addr,dword page_count){
 	res = pm.reserve(page_count);
 	if (!res)
 		return false;
-	res = imp_iterate(pdpt_table,base_addr,page_count,[](PTE& pt,qword,qword) -> bool{
-		assert(pt.preserve && !pt.bypass && !pt.present);
-		pt.page_addr = pm.allocate(PM::TAKE) >> 12;
-		pt.xd = 1;
-		pt.pat = 0;
-		pt.user = 0;
-		pt.write = 1;
-		pt.present = 1;
-		return true;
-	});
-	if (res != page_count)
-		bugcheck("page count mispatch (%x,%x)",res,page_count);
+	commit_reserved(pdpt_table,base_addr,page_count,false);
 	used_pages += page_count;
 	return true;
 }
@@ -181,26 +204,30 @@ bool kernel_vspace::protect(qword base_addr,dword page_count,qword attrib){
 	qword mask = PAGE_XD | PAGE_GLOBAL | PAGE_CD | PAGE_WT | PAGE_WRITE | PAGE_PRESENT;
 	if (attrib & ~mask)
 		return false;
-	interrupt_guard<spin_lock> guard(objlock);
-	auto res = imp_iterate(pdpt_table,base_addr,page_count,[](PTE& pt,qword,qword) -> bool{
-		return (pt.present && !pt.bypass && !pt.user && pt.page_addr);
-	});
-	if (res != page_count)
-		return false;
+	{
+		interrupt_guard<spin_lock> guard(objlock);
+		auto res = imp_iterate(pdpt_table,base_addr,page_count,[](PTE& pt,qword,qword) -> bool{
+			return (pt.present && !pt.bypass && !pt.user && pt.page_addr);
+		});
+		if (res != page_count)
+			return false;
 
-	PTE_CALLBACK fun = [](PTE& pt,qword addr,qword attrib) -> bool{
-		assert(pt.present && !pt.bypass && !pt.user && pt.page_addr);
-		pt.xd = (attrib & PAGE_XD) ? 1 : 0;
-		pt.global = (attrib & PAGE_GLOBAL) ? 1 : 0;
-		pt.cd = (attrib & PAGE_CD) ? 1 : 0;
-		pt.wt = (attrib & PAGE_WT) ? 1 : 0;
-		pt.write = (attrib & PAGE_WRITE) ? 1 : 0;
-		invlpg((void*)addr);
-		return true;
-	};
-	res = imp_iterate(pdpt_table,base_addr,page_count,fun,attrib);
-	if (res != page_count)
-		bugcheck("page count mispatch (%x,%x)",res,page_count);
+		PTE_CALLBACK fun = [](PTE& pt,qword addr,qword attrib) -> bool{
+			assert(pt.present && !pt.bypass && !pt.user && pt.page_addr);
+			pt.xd = (attrib & PAGE_XD) ? 1 : 0;
+			//kernel half always global, see kernel_vspace::kernel_vspace
+			pt.global = 1;
+			pt.cd = (attrib & PAGE_CD) ? 1 : 0;
+			pt.wt = (attrib & PAGE_WT) ? 1 : 0;
+			pt.write = (attrib & PAGE_WRITE) ? 1 : 0;
+			invlpg((void*)addr);
+			return true;
+		};
+		res = imp_iterate(pdpt_table,base_addr,page_count,fun,attrib);
+		if (res != page_count)
+			bugcheck("page count mispatch (%x,%x)",res,page_count);
+	}
+	cores.shootdown();
 	return true;
 }
 
@@ -3,6 +3,7 @@
 #include "vm.hpp"
 #include "lang.hpp"
 #include "lock_guard.hpp"
+#include "process/include/core_state.hpp"
 
 using namespace UOS;
 
@@ -13,23 +14,32 @@ struct PMMSCAN{
 	dword reserved;
 };
 
-struct BLOCK{
-	byte 		:	6;
-	byte solid	:	1;		//0	-> pierce
-	byte free	:	1;		//0 -> used
-};
-static_assert(sizeof(BLOCK) == sizeof(byte),"BLOCK size mismatch");
+static constexpr qword bit(qword index){
+	return (qword)1 << (index & 0x3F);
+}
 
-PM::PM(void) : bmp_size(0),total(0),used(0),next(0){
+PM::PM(void) : level_count(0),run_hint(0),bmp_size(0),total(0),used(0),mag_list(nullptr),mag_size(0),zero_count(0){
 	PMMSCAN* const scan_base = (PMMSCAN*)PMMSCAN_BASE;
 	bmp_size = sysinfo->PMM_avl_top >> 12;
 
-	qword page_count = align_up(bmp_size,PAGE_SIZE) >> 12;
+	//layout levels from bottom up, all in qwords
+	qword bmp_len = 0;
+	for (qword count = align_up(bmp_size,0x40) >> 6;;count = align_up(count,0x40) >> 6){
+		if (level_count == max_level)
+			bugcheck("too many physical memory (0x%x pages)",bmp_size);
+		level_offset[level_count++] = bmp_len;
+		bmp_len += count;
+		if (count == 1)
+			break;
+	}
+
+	qword page_count = bmp_pages = align_up(bmp_len*sizeof(qword),PAGE_SIZE) >> 12;
 	qword pdt_count = align_up(page_count,PAGE_SIZE/sizeof(qword)) >> 9;
 
-	dbgprint("bmp_size = %x, page_count = %x, pdt_count = %x",bmp_size,page_count,pdt_count);
+	dbgprint("bmp_size = %x, level_count = %d, page_count = %x, pdt_count = %x",bmp_size,level_count,page_count,pdt_count);
 
-	constexpr auto pdt_limit = (BOOT_AREA_TOP - DIRECT_MAP_TOP) >> 12;
+	//last page of boot area kept for AP trampoline
+	constexpr auto pdt_limit = (AP_ENTRY_PBASE - DIRECT_MAP_TOP) >> 12;
 
 	if (pdt_count > pdt_limit)
 		bugcheck("too many physical memory (0x%x pages)",bmp_size);
@@ -77,7 +87,7 @@ PM::PM(void) : bmp_size(0),total(0),used(0),next(0){
 		++i;
 	}
 
-	auto pmm_bmp = (BLOCK* const)PMMBMP_BASE;
+	auto pmm_bmp = (qword* const)PMMBMP_BASE;
 	zeromemory(pmm_bmp,page_count*PAGE_SIZE);
 	//scan & fill bmp
 	for (auto it = scan_base;it->type;++it){
@@ -94,9 +104,9 @@ PM::PM(void) : bmp_size(0),total(0),used(0),next(0){
 		auto index = aligned_base / PAGE_SIZE;
 		while(aligned_count--){
 			assert(index < bmp_size);
-			if (0 == pmm_bmp[index].free){
+			if (0 == (pmm_bmp[index >> 6] & bit(index))){
 				++total;
-				pmm_bmp[index].free = 1;
+				pmm_bmp[index >> 6] |= bit(index);
 			}
 			++index;
 		}
@@ -105,32 +115,33 @@ PM::PM(void) : bmp_size(0),total(0),used(0),next(0){
 	constexpr auto boot_area_count = BOOT_AREA_TOP >> 12;
 	//set pre-allocated pages
 	//auto pre_alloc_size = 0x0B + sysinfo->kernel_page;
+	auto take = [=](qword index){
+		pmm_bmp[index >> 6] &= ~bit(index);
+	};
 	for (i = 0;i < direct_map_count + pdt_count;++i){
-		pmm_bmp[i].free = 0;
-		//pmm_bmp[i].tag = 0x3F;
+		take(i);
 	}
+	take(AP_ENTRY_PBASE >> 12);
 
 	for (i = 0;i < sysinfo->kernel_page;++i){
 		assert(boot_area_count + i < bmp_size);
-		pmm_bmp[boot_area_count + i].free = 0;
-		//pmm_bmp[boot_area_count + i].tag = 0x3F;
+		take(boot_area_count + i);
 	}
 	for (i = 0;i < page_count;++i){
 		assert((bmp_pbase >> 12) + i < bmp_size);
-		pmm_bmp[(bmp_pbase >> 12) + i].free = 0;
-		//pmm_bmp[(bmp_pbase >> 12) + i].tag = 0x3F;
+		take((bmp_pbase >> 12) + i);
 	}
-	used = direct_map_count + pdt_count + page_count + sysinfo->kernel_page;
+	used = direct_map_count + pdt_count + 1 + page_count + sysinfo->kernel_page;
 	assert(used < total);
 
-	//build solid
-	for (i = 0;i < page_count;++i){
-		for (auto off = PAGE_SIZE;off;){
-			--off;
-			auto& cur = pmm_bmp[i*PAGE_SIZE + off];
-			cur.solid = 1;
-			if (cur.free)
-				break;
+	//build summary levels
+	for (unsigned level = 1;level < level_count;++level){
+		auto lower = pmm_bmp + level_offset[level - 1];
+		auto upper = pmm_bmp + level_offset[level];
+		auto count = level_offset[level] - level_offset[level - 1];
+		for (i = 0;i < count;++i){
+			if (lower[i])
+				upper[i >> 6] |= bit(i);
 		}
 	}
 
@@ -141,10 +152,20 @@ PM::PM(void) : bmp_size(0),total(0),used(0),next(0){
 }
 
 void PM::set_mp_count(dword count){
+	assert(count);
+	//heap calls back into PM, allocate before locking
+	auto list = (magazine*)operator new(sizeof(magazine)*count);
+	for (unsigned i = 0;i < count;++i)
+		new (list + i) magazine();
+	//each core caches about 1/(2*count) of soft_critical_limit
+	word size = min<dword>(max<dword>(soft_critical_limit/(2*count),8),max_magazine);
+
 	interrupt_guard<spin_lock> guard(lock);
 	if (hard_critical_limit)
 		bugcheck("invalid PM::set_mp_count call from %p",return_address());
 	hard_critical_limit = 4*count;
+	mag_size = size;
+	mag_list = list;
 }
 
 void PM::set_critical_callback(critical_callback cb,void* ud){
@@ -162,115 +183,440 @@ void PM::critical_check(void){
 	}
 }
 
-qword PM::allocate(MODE mode){
-	critical_check();
-	interrupt_guard<spin_lock> guard(lock);
-	if (mode == NONE && used + reserved + hard_critical_limit >= total){
-		return 0;
+PM::magazine* PM::local_magazine(void){
+	IF_assert;
+#ifndef PM_TEST	//bitmap stays exact for check_integrity
+	if (mag_list && features.get(decltype(features)::PS))
+		return mag_list + this_core().index();
+#endif
+	return nullptr;
+}
+
+qword PM::take_page(void){
+	assert(lock.is_locked());
+	auto pmm_bmp = (qword* const)PMMBMP_BASE;
+	//walk down from top level, lowest free page first
+	qword res_page = 0;
+	for (unsigned level = level_count;level--;){
+		auto data = pmm_bmp[level_offset[level] + res_page];
+		if (0 == data){	//only top level can be empty
+			assert(level + 1 == level_count);
+			return 0;
+		}
+		res_page = (res_page << 6) | bsf(data);
 	}
+	assert(res_page < bmp_size);
+	mark_used(res_page);
+	return res_page << 12;
+}
+
+void PM::mark_used(qword page){
+	auto pmm_bmp = (qword* const)PMMBMP_BASE;
+	//clear bit, propagate upwards when qword becomes empty
+	for (unsigned level = 0;level < level_count;++level){
+		auto& cur = pmm_bmp[level_offset[level] + (page >> 6)];
+		assert(cur & bit(page));
+		cur &= ~bit(page);
+		if (cur)
+			break;
+		page >>= 6;
+	}
+}
 
-	auto pmm_bmp = (BLOCK* const)PMMBMP_BASE;
-	auto page_count = align_up(bmp_size,PAGE_SIZE) >> 12;
-	auto page = next;
-	do{
-		assert(page < page_count);
-		auto& cur = pmm_bmp[page*PAGE_SIZE];
-		if (1 == cur.solid && 0 == cur.free){
-			;	//no free memory, next page
+qword PM::next_word(qword index) const{
+	auto pmm_bmp = (qword const* const)PMMBMP_BASE;
+	auto word_count = align_up(bmp_size,0x40) >> 6;
+	if (index >= word_count)
+		return word_count;
+	if (level_count == 1){
+		while(index < word_count && 0 == pmm_bmp[index])
+			++index;
+		return index;
+	}
+	if (pmm_bmp[index])
+		return index;
+	//bit 'pos' of a level stands for word 'pos' of the level below
+	//climb while nothing set from 'pos' in its word
+	auto pos = index;
+	unsigned level = 1;
+	while(true){
+		if (level == level_count || pos >= level_offset[level] - level_offset[level - 1])
+			return word_count;
+		qword mask = pmm_bmp[level_offset[level] + (pos >> 6)] & ~(bit(pos) - 1);
+		if (mask){
+			pos = (pos & ~(qword)0x3F) | bsf(mask);
+			break;
 		}
-		else{
-			break;	//has free page
+		pos = (pos >> 6) + 1;
+		++level;
+	}
+	//then down through lowest bits
+	while(--level)
+		pos = (pos << 6) | bsf(pmm_bmp[level_offset[level] + pos]);
+	return pos;
+}
+
+qword PM::find_aligned(qword from,qword to,qword need,qword step) const{
+	auto pmm_bmp = (qword const* const)PMMBMP_BASE;
+	auto i = align_up(from,step);
+	while(i + need <= to){
+		//empty words skipped through upper levels
+		auto next = next_word(i);
+		if (next != i){
+			i = align_up(next,step);
+			continue;
 		}
-		if (++page == page_count)
-			page = 0;
-		if (page == next){	//no free memory
-			bugcheck("physical memory used up (%x,%x,%x)",total,used,reserved);
-			//return 0;
+		qword k = 0;
+		while(k < need && pmm_bmp[i + k] == ~(qword)0)
+			++k;
+		if (k == need)
+			return i;
+		i = align_up(i + k + 1,step);
+	}
+	return ~(qword)0;
+}
+
+qword PM::find_run(qword from,qword to,dword count,qword& limit) const{
+	auto pmm_bmp = (qword const* const)PMMBMP_BASE;
+	qword run_base = 0;
+	qword run_length = 0;
+	for (auto i = from;i < to;++i){
+		auto data = pmm_bmp[i];
+		if (0 == data){
+			run_length = 0;
+			i = next_word(i + 1) - 1;
+			continue;
 		}
-	}while (true);
-	next = page;
-
-	qword head = 0,tail = PAGE_SIZE;
-	while (head + 1 < tail){
-		auto mid = (head + tail)/2;
-		auto& cur = pmm_bmp[page*PAGE_SIZE + mid];
-		if (cur.solid){
-			tail = mid;
+		if (0 == limit--)
+			break;
+		if (data == ~(qword)0){
+			if (0 == run_length)
+				run_base = i << 6;
+			run_length += 0x40;
+			if (run_length >= count)
+				return run_base;
+			continue;
 		}
-		else{
-			head = mid;
+		//free bits at bottom continue run from words below
+		auto low = bsf(~data);
+		if (run_length && run_length + low >= count)
+			return run_base;
+		if (count <= 0x40){
+			//bit set where 'count' free pages begin, length doubled each step
+			qword mask = data;
+			for (dword len = 1;mask && len < count;){
+				auto shift = min(len,count - len);
+				mask &= mask >> shift;
+				len += shift;
+			}
+			if (mask)
+				return (i << 6) + bsf(mask);
 		}
+		//free bits at top start a new run
+		run_length = (data >> 63) ? 63 - bsr(~data) : 0;
+		run_base = (i << 6) + 0x40 - run_length;
 	}
-	assert(head + 1 == tail);
-	assert(tail < PAGE_SIZE);
-	if (0 == pmm_bmp[page*PAGE_SIZE + head].solid)
-		++head;
-	assert(head < PAGE_SIZE);
+	return ~(qword)0;
+}
 
-	qword res_page = page*PAGE_SIZE + head;
-	assert(res_page < bmp_size);
+qword PM::take_run(dword count,dword align,qword limit){
+	assert(lock.is_locked());
+	assert(count && align);
+	auto word_count = align_up(bmp_size,0x40) >> 6;
+	//from where last run ended, then wrap around
+	auto hint = (run_hint < word_count) ? run_hint : 0;
+	qword base;
+	if (align > 1){
+		//whole words only, run starts on 'align' boundary
+		assert(0 == (align & 0x3F) && 0 == (count & 0x3F));
+		const qword step = align >> 6;
+		const qword need = count >> 6;
+		auto index = find_aligned(hint,word_count,need,step);
+		if (index == ~(qword)0)
+			index = find_aligned(0,min(hint + need,word_count),need,step);
+		if (index == ~(qword)0)
+			return 0;
+		base = index << 6;
+	}
+	else{
+		base = find_run(hint,word_count,count,limit);
+		if (base == ~(qword)0)
+			base = find_run(0,min<qword>(hint + (count >> 6) + 1,word_count),count,limit);
+		if (base == ~(qword)0)
+			return 0;
+	}
+	for (auto page = base;page < base + count;++page)
+		mark_used(page);
+	run_hint = (base + count) >> 6;
+	return base << 12;
+}
 
-	auto& res_stat = pmm_bmp[res_page];
-	assert(res_stat.solid && res_stat.free);
-	res_stat.free = 0;
+bool PM::quota(qword count,MODE mode){
+	if (mode == NONE && used + reserved + count + hard_critical_limit > total)
+		return false;
+	assert(used + reserved + (mode == TAKE ? 0 : count) <= total);
+	if (mode == TAKE){
+		assert(reserved >= count);
+		lock_sub(&reserved,count);
+	}
+	return true;
+}
 
-	while(head){
-		--head;
-		auto& cur = pmm_bmp[page* PAGE_SIZE + head];
-		assert(0 == cur.solid);
-		cur.solid = 1;
-		if (cur.free)
+void PM::put_page(qword pa){
+	assert(lock.is_locked());
+	auto page = pa >> 12;
+	auto pmm_bmp = (qword* const)PMMBMP_BASE;
+	if (pmm_bmp[page >> 6] & bit(page))
+		bugcheck("double release %p",pa);
+	//set bit, propagate upwards when qword was empty
+	for (unsigned level = 0;level < level_count;++level){
+		auto& cur = pmm_bmp[level_offset[level] + (page >> 6)];
+		bool was_empty = (0 == cur);
+		cur |= bit(page);
+		if (!was_empty)
 			break;
+		page >>= 6;
 	}
-	assert(used + reserved < total);
-	if (mode == TAKE){
-		assert(reserved);
-		--reserved;
+}
+
+void PM::refill(magazine& mag){
+	assert(mag.lock.is_locked() && mag.count == 0);
+	lock_guard<spin_lock> guard(lock);
+	while(mag.count < mag_size/2){
+		auto pa = take_page();
+		if (0 == pa)
+			break;
+		mag.page[mag.count++] = pa;
+	}
+}
+
+void PM::drain(magazine& mag){
+	assert(mag.lock.is_locked() && mag.count == mag_size);
+	lock_guard<spin_lock> guard(lock);
+	while(mag.count > mag_size/2){
+		put_page(mag.page[--mag.count]);
+	}
+}
+
+qword PM::steal(void){
+	IF_assert;
+	if (mag_list == nullptr)
+		return 0;
+	for (unsigned i = 0;i < cores.capacity();++i){
+		auto& mag = mag_list[i];
+		lock_guard<spin_lock> guard(mag.lock);
+		if (mag.count)
+			return mag.page[--mag.count];
+	}
+	lock_guard<spin_lock> guard(zero_lock);
+	if (zero_count)
+		return zero_list[--zero_count];
+	return 0;
+}
+
+qword PM::allocate(MODE mode){
+	critical_check();
+	interrupt_guard<void> guard;
+	if (!quota(1,mode))
+		return 0;
+	qword pa = 0;
+	auto mag = local_magazine();
+	if (mag){
+		lock_guard<spin_lock> mag_guard(mag->lock);
+		if (0 == mag->count)
+			refill(*mag);
+		if (mag->count)
+			pa = mag->page[--mag->count];
 	}
-	++used;
+	else{
+		lock_guard<spin_lock> pm_guard(lock);
+		pa = take_page();
+		if (pa){
+			lock_add(&used,(qword)1);
+#ifdef PM_TEST
+			check_integrity();
+#endif
+			return pa;
+		}
+	}
+	if (0 == pa)	//bitmap used up, take from other cores
+		pa = steal();
+	if (0 == pa)
+		bugcheck("physical memory used up (%x,%x,%x)",total,used,reserved);
+	assert(pa < (bmp_size << 12));
+	lock_add(&used,(qword)1);
+	return pa;
+}
+
+dword PM::allocate_batch(dword count,qword* out,MODE mode,bool zeroed){
+	assert(count && out);
+	critical_check();
+	dword zero_base;
+	{
+		interrupt_guard<void> guard;
+		if (!quota(count,mode))
+			return 0;
+		dword res = 0;
+		if (zeroed){
+			lock_guard<spin_lock> zero_guard(zero_lock);
+			while(res < count && zero_count)
+				out[res++] = zero_list[--zero_count];
+			lock_add(&used,(qword)res);
+		}
+		zero_base = res;
+		auto mag = local_magazine();
+		if (mag && res < count){
+			//fits in local magazine, global lock not taken
+			lock_guard<spin_lock> mag_guard(mag->lock);
+			if (count - res <= mag->count){
+				lock_add(&used,(qword)(count - res));
+				while(res < count)
+					out[res++] = mag->page[--mag->count];
+			}
+		}
+		if (res < count){
+			lock_guard<spin_lock> pm_guard(lock);
+			//contiguous run if found soon, single pages otherwise
+			auto base = (count - res > 1) ? take_run(count - res,1,run_scan_limit) : 0;
+			if (base){
+				for (auto i = res;i < count;++i)
+					out[i] = base + (i - res)*PAGE_SIZE;
+				lock_add(&used,(qword)(count - res));
+				res = count;
+			}
+			else{
+				auto prev = res;
+				for (;res < count;++res){
+					auto pa = take_page();
+					if (0 == pa)
+						break;
+					out[res] = pa;
+				}
+				lock_add(&used,(qword)(res - prev));
+			}
+#ifdef PM_TEST
+			check_integrity();
+#endif
+		}
+		//bitmap used up, take from magazines
+		while(res < count){
+			auto pa = steal();
+			if (0 == pa)
+				bugcheck("physical memory used up (%x,%x,%x)",total,used,reserved);
+			out[res++] = pa;
+			lock_add(&used,(qword)1);
+		}
+	}
+	//cleared with interrupts on, up to a whole batch of pages
+	if (zeroed){
+		map_view view;
+		for (auto i = zero_base;i < count;++i){
+			view.map(out[i]);
+			zeromemory((void*)view,PAGE_SIZE);
+		}
+		if (zero_low())
+			zero_worker.signal();
+	}
+	return count;
+}
+
+qword PM::allocate_contiguous(dword count,MODE mode,dword align){
+	assert(count);
+	critical_check();
+	interrupt_guard<void> guard;
+	if (!quota(count,mode))
+		return 0;
+	lock_guard<spin_lock> pm_guard(lock);
+	auto base = take_run(count,align);
+	if (base)
+		lock_add(&used,(qword)count);
+	else if (mode == TAKE)	//give back reservation
+		lock_add(&reserved,(qword)count);
 #ifdef PM_TEST
 	check_integrity();
 #endif
-	return res_page << 12;
+	return base;
+}
+
+qword PM::allocate_large(MODE mode){
+	auto base = allocate_contiguous(0x200,mode,0x200);
+	if (base){
+		map_view view;
+		qword list[map_view::max_count];
+		for (dword off = 0;off < 0x200;off += map_view::max_count){
+			for (dword i = 0;i < map_view::max_count;++i)
+				list[i] = base + (qword)(off + i)*PAGE_SIZE;
+			view.map(list,map_view::max_count);
+			zeromemory((void*)view,map_view::max_count*PAGE_SIZE);
+		}
+	}
+	return base;
+}
+
+qword PM::zero_pick(void){
+#ifdef PM_TEST	//bitmap stays exact for check_integrity
+	return 0;
+#endif
+	if (zero_count >= zero_pool_size || used + reserved + soft_critical_limit >= total)
+		return 0;
+	interrupt_guard<spin_lock> guard(lock);
+	return take_page();
+}
+
+void PM::zero_put(qword pa){
+	interrupt_guard<spin_lock> guard(zero_lock);
+	assert(zero_count < zero_pool_size);
+	zero_list[zero_count++] = pa;
 }
 
 bool PM::reserve(dword page_count){
 	critical_check();
 	interrupt_guard<spin_lock> guard(lock);
 	if (used + reserved + page_count + hard_critical_limit < total){
-		reserved += page_count;
+		lock_add(&reserved,(qword)page_count);
 		return true;
 	}
 	return false;
 }
 
+void PM::unreserve(dword page_count){
+	assert(reserved >= page_count);
+	lock_sub(&reserved,(qword)page_count);
+}
+
 void PM::release(qword pa){
 	assert(0 == (pa & PAGE_MASK));
 	auto page = pa >> 12;
 	assert(page < bmp_size);
-	interrupt_guard<spin_lock> guard(lock);
-	auto pmm_bmp = (BLOCK* const)PMMBMP_BASE;
-	auto& cur = pmm_bmp[page];
-	if (cur.free)
-		bugcheck("double release %p",pa);
-	cur.free = 1;
-	if (page + 1 == PAGE_SIZE){		//last element
-		assert(cur.solid);
-	}
-	else{	//solid state no change
-		;
-	}
-	while(page & PAGE_MASK){	//clear solid of forw blocks
-		--page;
-		if (0 == pmm_bmp[page].solid)
-			break;
-		pmm_bmp[page].solid = 0;
+	interrupt_guard<void> guard;
+	auto mag = local_magazine();
+	if (mag){
+		//bit of an owned page never changes, safe without lock
+		auto pmm_bmp = (qword* const)PMMBMP_BASE;
+		if (pmm_bmp[page >> 6] & bit(page))
+			bugcheck("double release %p",pa);
+		lock_guard<spin_lock> mag_guard(mag->lock);
+		//bit stays clear while cached, check this magazine as well
+		for (word i = 0;i < mag->count;++i){
+			if (mag->page[i] == pa)
+				bugcheck("double release %p",pa);
+		}
+		if (mag->count == mag_size)
+			drain(*mag);
+		mag->page[mag->count++] = pa;
 	}
-	assert(used);
-	--used;
+	else{
+		lock_guard<spin_lock> pm_guard(lock);
+		put_page(pa);
+		assert(used);
+		lock_sub(&used,(qword)1);
 #ifdef PM_TEST
-	check_integrity();
+		check_integrity();
 #endif
+		return;
+	}
+	assert(used);
+	lock_sub(&used,(qword)1);
 }
 
 bool PM::peek(void* dest,qword paddr,size_t count){
@@ -291,28 +637,20 @@ bool PM::peek(void* dest,qword paddr,size_t count){
 
 #ifdef PM_TEST
 void PM::check_integrity(void){
-	auto pmm_bmp = (BLOCK* const)PMMBMP_BASE;
-	auto page_count = align_up(bmp_size,PAGE_SIZE) >> 12;
-	auto discovered_free_page = 0;
-	for (unsigned page = 0;page < page_count;++page){
-		auto pierce = 1;
-		for (unsigned i = 0;i < PAGE_SIZE;++i){
-			auto& cur = pmm_bmp[page*PAGE_SIZE + i];
-			if (pierce){
-				if (cur.solid){
-					if (cur.free || i == 0)
-						pierce = 0;
-					else
-						bugcheck("PM corrupted");
-				}
-				if (cur.free)
-					++discovered_free_page;
-			}
-			else if (1 == cur.free || 0 == cur.solid)
+	auto pmm_bmp = (qword* const)PMMBMP_BASE;
+	qword discovered_free_page = 0;
+	for (qword i = 0;i < (align_up(bmp_size,0x40) >> 6);++i){
+		for (auto data = pmm_bmp[i];data;data &= data - 1)
+			++discovered_free_page;
+	}
+	for (unsigned level = 1;level < level_count;++level){
+		auto lower = pmm_bmp + level_offset[level - 1];
+		auto upper = pmm_bmp + level_offset[level];
+		auto count = level_offset[level] - level_offset[level - 1];
+		for (qword i = 0;i < count;++i){
+			if ((0 != lower[i]) != (0 != (upper[i >> 6] & bit(i))))
 				bugcheck("PM corrupted");
 		}
-		if (pierce)
-			bugcheck("PM corrupted");
 	}
 	if (discovered_free_page + used != total)
 		bugcheck("PM corrupted: free size mispatch 0x%x",discovered_free_page);
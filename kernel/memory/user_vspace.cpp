@@ -5,16 +5,29 @@
 #include "lang.hpp"
 #include "assert.hpp"
 #include "intrinsics.hpp"
+#include "process/include/core_state.hpp"
 
 using namespace UOS;
 
-user_vspace::user_vspace(void) : cr3(pm.allocate(PM::MUST_SUCCEED)), pl4te(pm.allocate(PM::MUST_SUCCEED)) {
+qword user_vspace::new_uid(void){
+	static qword volatile next_uid = 0;
+	qword cur;
+	do{
+		cur = next_uid;
+	}while(cur != cmpxchg<qword>(&next_uid,cur + 1,cur));
+	//0 marks empty PCID slot
+	return cur + 1;
+}
+
+user_vspace::user_vspace(void) : cr3(pm.allocate(PM::MUST_SUCCEED)), pl4te(pm.allocate(PM::MUST_SUCCEED)), uid(new_uid()) {
 	map_view view(cr3);
 	{
 		zeromemory((void*)view,PAGE_SIZE);
 		auto pl4t_table = (qword*)view;
 		pl4t_table[0] = (pl4te | PAGE_USER | PAGE_WRITE | PAGE_PRESENT);
 		pl4t_table[0x100] = (PDPT8_PBASE | PAGE_USER | PAGE_WRITE | PAGE_PRESENT);
+		//read-only to kernel, see peek_local
+		pl4t_table[PT_WINDOW_INDEX] = (cr3 | PAGE_XD | PAGE_PRESENT);
 	}
 	view.map(pl4te);
 	qword pa_pdt = pm.allocate(PM::MUST_SUCCEED);
@@ -31,6 +44,18 @@ user_vspace::user_vspace(void) : cr3(pm.allocate(PM::MUST_SUCCEED)), pl4te(pm.al
 	used_pages = 3;
 }
 
+user_vspace::user_vspace(clone_tag) : cr3(pm.allocate(PM::MUST_SUCCEED)), pl4te(pm.allocate(PM::MUST_SUCCEED)), uid(new_uid()) {
+	map_view view(cr3);
+	zeromemory((void*)view,PAGE_SIZE);
+	auto pl4t_table = (qword*)view;
+	pl4t_table[0] = (pl4te | PAGE_USER | PAGE_WRITE | PAGE_PRESENT);
+	pl4t_table[0x100] = (PDPT8_PBASE | PAGE_USER | PAGE_WRITE | PAGE_PRESENT);
+	pl4t_table[PT_WINDOW_INDEX] = (cr3 | PAGE_XD | PAGE_PRESENT);
+	view.map(pl4te);
+	zeromemory((void*)view,PAGE_SIZE);
+	used_pages = 2;
+}
+
 user_vspace::~user_vspace(void){
 	interrupt_guard<rwlock> guard(objlock);
 	{
@@ -43,17 +68,35 @@ user_vspace::~user_vspace(void){
 					map_view pdt_view(pa_pdt);
 					auto pdt_table = (PDTE*)pdt_view;
 					for (unsigned pdt_index = 0;pdt_index < 0x200;++pdt_index){
-						if (pdt_table[pdt_index].present){
+						const auto& pdt = pdt_table[pdt_index];
+						if (pdt.present && pdt.ps){
+							//2M page, capacity of its page table still reserved
+							if (!pdt.bypass){
+								for (unsigned i = 0;i < 0x200;++i)
+									pm.release((pdt.pt_addr + i) << 12);
+							}
+							pm.unreserve(1);
+						}
+						else if (pdt_table[pdt_index].present){
 							qword pa_pt = pdt_table[pdt_index].pt_addr << 12;
 							{
 								map_view pt_view(pa_pt);
 								auto pt_table = (PTE*)pt_view;
 								for (unsigned pt_index = 0;pt_index < 0x200;++pt_index){
 									auto& cur = pt_table[pt_index];
-									if (cur.present){
+									if (cur.shared() || cur.cow()){
+										assert(cur.user && !cur.bypass);
+										imp_unshare(cur,((qword)pdpt_index << 30) | ((qword)pdt_index << 21) | ((qword)pt_index << 12));
+									}
+									else if (cur.present){
 										assert(cur.user);
 										cur.present = 0;
-										pm.release(cur.page_addr << 12);
+										if (!cur.bypass)
+											pm.release(cur.page_addr << 12);
+									}
+									else if (cur.lazy()){
+										cur.valid = 0;
+										pm.unreserve(1);
 									}
 								}
 							}
@@ -67,6 +110,10 @@ user_vspace::~user_vspace(void){
 	}
 	pm.release(pl4te);
 	pm.release(cr3);
+	for (auto& region : regions){
+		if (region.source)
+			region.source->relax();
+	}
 }
 
 qword user_vspace::get_cr3(void) const{
@@ -130,9 +177,66 @@ bool user_vspace::release(qword addr,dword page_count){
 	});
 	if (res != page_count)
 		return false;
+	imp_stale();
+	//frames held until no core caches their entries
+	struct cursor_t{
+		user_vspace* self;
+		retire_list retire;
+	} cursor;
+	cursor.self = this;
+	cursor.retire.count = 0;
+	PTE_CALLBACK fun = [](PTE& pt,qword va,qword data) -> bool{
+		auto cursor = (cursor_t*)data;
+		auto& retire = cursor->retire;
+		if (!pt.present){
+			if (pt.sourced())
+				cursor->self->imp_unref(pt.data);
+			return true;
+		}
+		if (retire.count == retire_list::limit)
+			return false;
+		auto& cur = retire.list[retire.count++];
+		cur.va = va;
+		cur.pa = pt.page_addr << 12;
+		cur.data = pt.data;
+		cur.shared = pt.shared() || pt.cow();
+		cur.sourced = pt.sourced();
+		//left as reserved page, see imp_release
+		pt.present = 0;
+		pt.valid = 0;
+		pt.data = 0;
+		pt.page_addr = 0;
+		pt.preserve = 1;
+		--cursor->self->used_pages;
+		invlpg((void*)va);
+		return true;
+	};
+	dword count = 0;
+	while(count < page_count){
+		count += imp_iterate(pdpt_table,addr + (qword)count*PAGE_SIZE,page_count - count,fun,reinterpret_cast<qword>(&cursor));
+		imp_retire(cursor.retire);
+	}
 	return safe_release(pdpt_table,addr,page_count);
 }
 
+void user_vspace::imp_retire(retire_list& retire){
+	assert(is_exclusive());
+	if (retire.count == 0)
+		return;
+	imp_stale();
+	cores.shootdown(this);
+	for (dword i = 0;i < retire.count;++i){
+		const auto& cur = retire.list[i];
+		if (cur.shared)
+			imp_unshare(cur.va,cur.pa,cur.data);
+		else
+			pm.release(cur.pa);
+		if (cur.sourced)
+			imp_unref(cur.data);
+	}
+	retire.count = 0;
+}
+
 bool user_vspace::commit(qword base_addr,dword page_count){
 	if (!common_check(base_addr,page_count))
 		return false;
@@ -141,29 +245,210 @@ bool user_vspace::commit(qword base_addr,dword page_count){
 	auto pdpt_table = (PDPTE*)view;
 	interrupt_guard<rwlock> guard(objlock);
 	auto res = imp_iterate(pdpt_table,base_addr,page_count,[](PTE& pt,qword,qword) -> bool{
-		return (pt.preserve && !pt.bypass && !pt.present);
+		return (pt.preserve && !pt.bypass && !pt.present && !pt.valid);
 	});
 	if (res != page_count)
 		return false;
 	res = pm.reserve(page_count);
 	if (!res)
 		return false;
-	res = imp_iterate(pdpt_table,base_addr,page_count,[](PTE& pt,qword,qword) -> bool{
+	commit_reserved(pdpt_table,base_addr,page_count,true);
+	//page tables may be merged into large pages
+	imp_stale();
+	used_pages += page_count;
+	return true;
+}
+
+bool user_vspace::commit_lazy(qword base_addr,dword page_count){
+	return imp_commit_lazy(base_addr,page_count,nullptr,0,0);
+}
+
+bool user_vspace::map_source(qword base_addr,dword page_count,page_source* source,qword offset,qword length){
+	if (source == nullptr || (offset & PAGE_MASK))
+		return false;
+	return imp_commit_lazy(base_addr,page_count,source,offset,length);
+}
+
+bool user_vspace::imp_commit_lazy(qword base_addr,dword page_count,page_source* source,qword offset,qword length){
+	if (!common_check(base_addr,page_count))
+		return false;
+
+	map_view view(pl4te);
+	auto pdpt_table = (PDPTE*)view;
+	interrupt_guard<rwlock> guard(objlock);
+	auto res = imp_iterate(pdpt_table,base_addr,page_count,[](PTE& pt,qword,qword) -> bool{
+		return (pt.preserve && !pt.bypass && !pt.present && !pt.valid);
+	});
+	if (res != page_count)
+		return false;
+	//PTE::data holds region index + 1, free slot reused
+	qword index = 0;
+	if (source){
+		while(index < regions.size() && regions[index].source)
+			++index;
+		if (index == regions.size()){
+			if (regions.size() >= max_region)
+				return false;
+			regions.push_back(source_region{nullptr,0,0,0,0});
+		}
+	}
+	//capacity taken now, so fault_in never fails
+	res = pm.reserve(page_count);
+	if (!res)
+		return false;
+	if (source){
+		regions[index] = source_region{source,base_addr,offset,length,page_count};
+		++index;
+	}
+	if (source)
+		source->acquire();
+	res = imp_iterate(pdpt_table,base_addr,page_count,[](PTE& pt,qword,qword index) -> bool{
 		assert(pt.preserve && !pt.bypass && !pt.present);
-		pt.page_addr = pm.allocate(PM::TAKE) >> 12;
+		//attributes kept in non-present PTE, applied on fault
+		pt.page_addr = 0;
 		pt.xd = 1;
 		pt.pat = 0;
 		pt.user = 1;
 		pt.write = 1;
-		pt.present = 1;
+		pt.data = index;
+		pt.valid = 1;
 		return true;
-	});
+	},index);
 	if (res != page_count)
 		bugcheck("page count mismatch (%x,%x)",res,page_count);
+	//stays lazy, large pages only from commit, see commit_reserved
 	used_pages += page_count;
 	return true;
 }
 
+bool user_vspace::fault_in(qword va){
+	va = align_down(va,PAGE_SIZE);
+	if (!common_check(va,1))
+		return false;
+	map_view view(pl4te);
+	auto pdpt_table = (PDPTE*)view;
+	//shared, callers may hold objlock while touching user memory
+	//fault_lock serializes fault_in, may sleep on file I/O
+	lock_guard<rwlock> guard(objlock,rwlock::SHARED);
+	lock_guard<rwlock> fault_guard(fault_lock);
+	auto pt = imp_peek(va,pdpt_table);
+	if (pt.present)	//other thread faulted in first
+		return !pt.bypass && pt.user;
+	if (!pt.lazy() || pt.bypass)
+		return false;
+	PTE val = pt;
+	const source_region* region = nullptr;
+	qword off = 0;
+	if (pt.data){
+		assert(pt.data <= regions.size());
+		region = &regions[pt.data - 1];
+		off = va - region->base;
+		if (off >= region->length)
+			region = nullptr;
+	}
+	qword pa = 0;
+	if (region && (!pt.write || region->source->writable())){
+		//read-only content or shared memory, try frame shared with other vspaces
+		pa = region->source->share(region->offset + off,min<qword>(region->length - off,PAGE_SIZE));
+		if (pa){
+			//capacity not used, frame owned by source
+			pm.unreserve(1);
+			val.page_addr = pa >> 12;
+			val.present = 1;
+		}
+	}
+	if (pa == 0){
+		void* buffer = nullptr;
+		dword len = 0;
+		if (region){
+			len = min<qword>(region->length - off,PAGE_SIZE);
+			//file system writes through kernel address, bounce to frame
+			buffer = operator new(PAGE_SIZE);
+			if (!region->source->fill(region->offset + off,buffer,len)){
+				//transient failure, page stays lazy for next fault
+				operator delete(buffer,PAGE_SIZE);
+				return false;
+			}
+		}
+		pm.allocate_batch(1,&pa,PM::TAKE,true);
+		if (buffer){
+			map_view frame(pa);
+			memcpy((void*)frame,buffer,len);
+			operator delete(buffer,PAGE_SIZE);
+		}
+		val.page_addr = pa >> 12;
+		//region kept on private copy for sync, beyond length too
+		val.valid = 0;
+		val.present = 1;
+	}
+	//single store, peek under shared lock never sees partial PTE
+	imp_iterate(pdpt_table,va,1,[](PTE& pt,qword,qword data) -> bool{
+		pt = *reinterpret_cast<const PTE*>(data);
+		return true;
+	},reinterpret_cast<qword>(&val));
+	return true;
+}
+
+void user_vspace::imp_unshare(qword va,qword pa,qword data){
+	if (data == 0){
+		cow_frames.relax(pa);
+	}
+	else{
+		assert(data <= regions.size());
+		const auto& region = regions[data - 1];
+		assert(va >= region.base && va - region.base < region.length);
+		region.source->unshare(region.offset + (va - region.base),pa);
+	}
+}
+
+void user_vspace::imp_unshare(PTE& pt,qword va){
+	assert(pt.shared() || pt.cow());
+	imp_unshare(va,pt.page_addr << 12,pt.data);
+	pt.present = 0;
+	pt.valid = 0;
+	pt.data = 0;
+	pt.page_addr = 0;
+	--used_pages;
+}
+
+void user_vspace::imp_unref(qword data){
+	assert(is_exclusive());
+	assert(data && data <= regions.size());
+	auto& region = regions[data - 1];
+	assert(region.source && region.pages);
+	if (--region.pages)
+		return;
+	region.source->relax();
+	region.source = nullptr;
+}
+
+bool user_vspace::copy_on_write(qword va){
+	va = align_down(va,PAGE_SIZE);
+	if (!common_check(va,1))
+		return false;
+	map_view view(pl4te);
+	auto pdpt_table = (PDPTE*)view;
+	//same locking as fault_in
+	lock_guard<rwlock> guard(objlock,rwlock::SHARED);
+	lock_guard<rwlock> fault_guard(fault_lock);
+	auto pt = imp_peek(va,pdpt_table);
+	if (!pt.cow())	//other thread copied first
+		return pt.present && pt.write && pt.user && !pt.bypass;
+	PTE val = pt;
+	val.page_addr = cow_frames.take(pt.page_addr << 12) >> 12;
+	val.valid = 0;
+	val.write = 1;
+	imp_iterate(pdpt_table,va,1,[](PTE& pt,qword,qword data) -> bool{
+		pt = *reinterpret_cast<const PTE*>(data);
+		return true;
+	},reinterpret_cast<qword>(&val));
+	invlpg((void*)va);
+	imp_stale();
+	//read-only entry of shared frame may live on other cores
+	cores.shootdown(this);
+	return true;
+}
+
 bool user_vspace::protect(qword base_addr,dword page_count,qword attrib){
 	if (!common_check(base_addr,page_count))
 		return false;
@@ -173,28 +458,286 @@ bool user_vspace::protect(qword base_addr,dword page_count,qword attrib){
 	map_view view(pl4te);
 	auto pdpt_table = (PDPTE*)view;
 	interrupt_guard<rwlock> guard(objlock);
-	auto res = imp_iterate(pdpt_table,base_addr,page_count,[](PTE& pt,qword,qword) -> bool{
-		return (pt.present && !pt.bypass && pt.user && pt.page_addr);
-	});
+	struct cursor_t{
+		const user_vspace* self;
+		qword attrib;
+		dword mapped;
+	} cursor = {this,attrib,0};
+	auto res = imp_iterate(pdpt_table,base_addr,page_count,[](PTE& pt,qword,qword data) -> bool{
+		auto cursor = (cursor_t*)data;
+		//shared frame never writable, unless source allows
+		if (pt.shared() && (cursor->attrib & PAGE_WRITE) && !cursor->self->regions[pt.data - 1].source->writable())
+			return false;
+		if (pt.present)
+			++cursor->mapped;
+		return (pt.present && !pt.bypass && pt.user && pt.page_addr) || (pt.lazy() && !pt.bypass);
+	},reinterpret_cast<qword>(&cursor));
 	if (res != page_count)
 		return false;
 	
 	PTE_CALLBACK fun = [](PTE& pt,qword addr,qword attrib) -> bool{
-		assert(pt.present && !pt.bypass && pt.user && pt.page_addr);
+		assert((pt.present && !pt.bypass && pt.user && pt.page_addr) || pt.lazy());
 		pt.xd = (attrib & PAGE_XD) ? 1 : 0;
-		pt.global = (attrib & PAGE_GLOBAL) ? 1 : 0;
+		//global user page would outlive CR3 switch
+		pt.global = 0;
 		pt.cd = (attrib & PAGE_CD) ? 1 : 0;
 		pt.wt = (attrib & PAGE_WT) ? 1 : 0;
+		if (pt.cow()){
+			//stays read-only until first write
+			if (attrib & PAGE_WRITE)
+				attrib &= ~PAGE_WRITE;
+			else{
+				//no longer writable, own the frame
+				pt.page_addr = cow_frames.take(pt.page_addr << 12) >> 12;
+				pt.valid = 0;
+			}
+		}
 		pt.write = (attrib & PAGE_WRITE) ? 1 : 0;
-		invlpg((void*)addr);
+		if (pt.present)
+			invlpg((void*)addr);
 		return true;
 	};
 	res = imp_iterate(pdpt_table,base_addr,page_count,fun,attrib);
 	if (res != page_count)
 		bugcheck("page count mismatch (%x,%x)",res,page_count);
+	imp_stale();
+	//writable entries may live on other cores
+	if (cursor.mapped)
+		cores.shootdown(this);
 	return true;
 }
 
+bool user_vspace::assign(qword base_addr,qword phy_addr,dword page_count){
+	if (!common_check(base_addr,page_count) || !phy_addr || (phy_addr & PAGE_MASK))
+		return false;
+	map_view view(pl4te);
+	auto pdpt_table = (PDPTE*)view;
+	interrupt_guard<rwlock> guard(objlock);
+	auto res = imp_iterate(pdpt_table,base_addr,page_count,[](PTE& pt,qword,qword) -> bool{
+		return (pt.preserve && !pt.bypass && !pt.present);
+	});
+	if (res != page_count)
+		return false;
+	//use delta to calc back phy_addr, see kernel_vspace::assign
+	if (base_addr < phy_addr)
+		bugcheck("assume phy_addr is far lower than base_addr (%x,%x)",phy_addr,base_addr);
+	PTE_CALLBACK fun = [](PTE& pt,qword addr,qword delta) -> bool{
+		assert(pt.preserve && !pt.bypass && !pt.present);
+		pt.page_addr = (addr - delta) >> 12;
+		pt.xd = 1;
+		pt.bypass = 1;
+		pt.pat = 0;
+		pt.user = 1;
+		pt.write = 0;
+		pt.present = 1;
+		return true;
+	};
+	res = imp_iterate(pdpt_table,base_addr,page_count,fun,base_addr - phy_addr);
+	if (res != page_count)
+		bugcheck("page count mismatch (%x,%x)",res,page_count);
+	return true;
+}
+
+user_vspace* user_vspace::clone(void){
+	map_view view(pl4te);
+	auto pdpt_table = (PDPTE*)view;
+	interrupt_guard<rwlock> guard(objlock);
+	map_view pdt_view;
+	map_view pt_view;
+	//capacity for page tables, private copies & extra references
+	qword count = 0;
+	for (unsigned pdpt_index = 0;pdpt_index < 0x200;++pdpt_index){
+		if (!pdpt_table[pdpt_index].present)
+			continue;
+		++count;
+		pdt_view.map(pdpt_table[pdpt_index].pdt_addr << 12);
+		auto pdt_table = (PDTE*)pdt_view;
+		for (unsigned pdt_index = 0;pdt_index < 0x200;++pdt_index){
+			if (!pdt_table[pdt_index].present)
+				continue;
+			++count;
+			//2M page shared copy-on-write per 4K page
+			if (pdt_table[pdt_index].ps)
+				imp_split(pdt_table[pdt_index],pt_view);
+			else
+				pt_view.map(pdt_table[pdt_index].pt_addr << 12);
+			auto pt_table = (PTE*)pt_view;
+			for (unsigned pt_index = 0;pt_index < 0x200;++pt_index){
+				const auto& cur = pt_table[pt_index];
+				if (!cur.bypass && (cur.present || cur.lazy()))
+					++count;
+			}
+		}
+	}
+	if (count > 0xFFFFFFFF || !pm.reserve(count))
+		return nullptr;
+	auto vs = new user_vspace(clone_tag());
+	//same slots, same page counts
+	for (auto& region : regions){
+		if (region.source)
+			region.source->acquire();
+		vs->regions.push_back(region);
+	}
+	map_view pdpt_copy_view(vs->pl4te);
+	map_view pdt_copy_view;
+	map_view pt_copy_view;
+	auto pdpt_copy = (PDPTE*)pdpt_copy_view;
+	//free block links & sizes copied as is
+	for (unsigned pdpt_index = 0;pdpt_index < 0x200;++pdpt_index){
+		pdpt_copy[pdpt_index] = pdpt_table[pdpt_index];
+		if (!pdpt_table[pdpt_index].present)
+			continue;
+		auto pa_pdt = pm.allocate(PM::TAKE);
+		pdpt_copy[pdpt_index].pdt_addr = pa_pdt >> 12;
+		pdt_view.map(pdpt_table[pdpt_index].pdt_addr << 12);
+		pdt_copy_view.map(pa_pdt);
+		auto pdt_table = (PDTE*)pdt_view;
+		auto pdt_copy = (PDTE*)pdt_copy_view;
+		memcpy(pdt_copy,pdt_table,PAGE_SIZE);
+		for (unsigned pdt_index = 0;pdt_index < 0x200;++pdt_index){
+			if (!pdt_table[pdt_index].present)
+				continue;
+			auto pa_pt = pm.allocate(PM::TAKE);
+			pdt_copy[pdt_index].pt_addr = pa_pt >> 12;
+			pt_view.map(pdt_table[pdt_index].pt_addr << 12);
+			pt_copy_view.map(pa_pt);
+			auto pt_table = (PTE*)pt_view;
+			auto pt_copy = (PTE*)pt_copy_view;
+			memcpy(pt_copy,pt_table,PAGE_SIZE);
+			for (unsigned pt_index = 0;pt_index < 0x200;++pt_index){
+				auto& cur = pt_table[pt_index];
+				auto& dst = pt_copy[pt_index];
+				//lazy page keeps its capacity, reserved page as is
+				if (cur.bypass || !cur.present)
+					continue;
+				qword pa = cur.page_addr << 12;
+				if (cur.shared()){
+					//child takes own reference on fault
+					dst.present = 0;
+					dst.page_addr = 0;
+				}
+				else if (cur.cow()){
+					cow_frames.acquire(pa);
+				}
+				else if (cur.write && cur.data == 0){
+					cur.write = 0;
+					cur.valid = 1;
+					assert(cur.data == 0);
+					invlpg((void*)(((qword)pdpt_index << 30) | ((qword)pdt_index << 21) | ((qword)pt_index << 12)));
+					dst = cur;
+					cow_frames.acquire(pa);
+				}
+				else{
+					//read-only or source backed private page, copied now
+					auto copy = pm.allocate(PM::TAKE);
+					map_view sor(pa);
+					map_view frame(copy);
+					memcpy((void*)frame,(const void*)sor,PAGE_SIZE);
+					dst.page_addr = copy >> 12;
+				}
+			}
+		}
+	}
+	//same layout, same count
+	vs->used_pages = used_pages;
+	//writable pages now copy-on-write, other threads may run on other cores
+	imp_stale();
+	cores.shootdown(this);
+	return vs;
+}
+
+bool user_vspace::sync(qword base_addr,dword page_count){
+	if (!common_check(base_addr,page_count))
+		return false;
+	map_view view(pl4te);
+	auto pdpt_table = (PDPTE*)view;
+	//same locking as fault_in, source I/O serialized
+	lock_guard<rwlock> guard(objlock,rwlock::SHARED);
+	auto tail = base_addr + (qword)page_count*PAGE_SIZE;
+	bool overlap = false;
+	for (const auto& region : regions){
+		if (region.source && region.base < tail && base_addr < region.base + region.length){
+			overlap = true;
+			break;
+		}
+	}
+	//no source mapped here, nothing to write back
+	if (!overlap)
+		return true;
+	lock_guard<rwlock> fault_guard(fault_lock);
+	void* buffer = nullptr;
+	bool res = true;
+	dword i = 0;
+	while(i < page_count){
+		//dirty pages cleared in batch, one shootdown for each batch
+		PTE batch[0x10];
+		qword batch_va[0x10];
+		dword count = 0;
+		for (;i < page_count && count < 0x10;++i){
+			auto va = base_addr + (qword)i*PAGE_SIZE;
+			auto pt = imp_peek(va,pdpt_table);
+			if (!pt.present || pt.valid || !pt.data || !pt.dirty)
+				continue;
+			assert(pt.data <= regions.size());
+			const auto& region = regions[pt.data - 1];
+			//beyond source length, zero filled, nothing to write back
+			if (va - region.base >= region.length)
+				continue;
+			//hardware may set A/D concurrently, clear by locked op
+			imp_iterate(pdpt_table,va,1,[](PTE& pt,qword,qword) -> bool{
+				lock_and(reinterpret_cast<qword volatile*>(&pt),~PAGE_DIRTY);
+				return true;
+			});
+			invlpg((void*)va);
+			batch[count] = pt;
+			batch_va[count++] = va;
+		}
+		if (count == 0)
+			continue;
+		//stale dirty entry elsewhere would write without marking again
+		imp_stale();
+		cores.shootdown(this);
+		//file system reads through kernel address, bounce from frame
+		if (buffer == nullptr)
+			buffer = operator new(PAGE_SIZE);
+		for (dword k = 0;k < count;++k){
+			const auto& pt = batch[k];
+			assert(pt.data <= regions.size());
+			const auto& region = regions[pt.data - 1];
+			auto off = batch_va[k] - region.base;
+			dword len = min<qword>(region.length - off,PAGE_SIZE);
+			{
+				map_view frame(pt.page_addr << 12);
+				memcpy(buffer,(const void*)frame,len);
+			}
+			if (!region.source->flush(region.offset + off,buffer,len))
+				res = false;
+		}
+	}
+	if (buffer)
+		operator delete(buffer,PAGE_SIZE);
+	return res;
+}
+
+bool user_vspace::sync(void){
+	bool res = true;
+	for (size_t i = 0;;++i){
+		qword base,length;
+		{
+			lock_guard<rwlock> guard(objlock,rwlock::SHARED);
+			if (i >= regions.size())
+				break;
+			if (regions[i].source == nullptr)
+				continue;
+			base = regions[i].base;
+			length = regions[i].length;
+		}
+		if (!sync(base,align_up(length,PAGE_SIZE)/PAGE_SIZE))
+			res = false;
+	}
+	return res;
+}
+
 PTE user_vspace::peek(qword va){
 	if (va >= size_512G)
 		return PTE{0};
@@ -203,20 +746,76 @@ PTE user_vspace::peek(qword va){
 	return imp_peek(va,pdpt_table);
 }
 
+//each level checked before touching the next, non-present table faults in window
+PTE user_vspace::peek_local(qword va) const{
+	assert(is_locked() && is_current());
+	if (va >= size_512G)
+		return PTE{0};
+	qword val = *((qword const volatile*)PDPT_WINDOW_BASE + (va >> 30));
+	if (!reinterpret_cast<const PDPTE&>(val).present)
+		return PTE{0};
+	val = *((qword const volatile*)PDT_WINDOW_BASE + (va >> 21));
+	const auto& pdt = reinterpret_cast<const PDTE&>(val);
+	if (!pdt.present)
+		return PTE{0};
+	if (pdt.ps)
+		return large_entry(pdt,(va >> 12) & 0x1FF);
+	val = *((qword const volatile*)PT_WINDOW_BASE + (va >> 12));
+	return reinterpret_cast<const PTE&>(val);
+}
+
+dword user_vspace::imp_gather(qword va,dword page_count,qword* list,bool write){
+	assert(is_locked());
+	assert(page_count && page_count <= map_view::max_count);
+	struct cursor_t{
+		qword* list;
+		bool write;
+	} cursor = {list,write};
+	//kernel writes through map_view, mark dirty as CPU would, see sync
+	PTE_CALLBACK fun = [](PTE& pt,qword,qword data) -> bool{
+		auto& cursor = *reinterpret_cast<cursor_t*>(data);
+		if (!pt.present || !pt.user || (cursor.write && !pt.write))
+			return false;
+		if (cursor.write && !pt.dirty)
+			lock_or(reinterpret_cast<qword volatile*>(&pt),PAGE_DIRTY);
+		*cursor.list++ = pt.page_addr << 12;
+		return true;
+	};
+	dword res;
+	{
+		map_view view(pl4te);
+		res = imp_iterate((const PDPTE*)view,va,page_count,fun,reinterpret_cast<qword>(&cursor));
+	}
+	if (res)
+		return res;
+	//first page lazy or copy-on-write
+	if (peek(va).lazy())
+		fault_in(va);
+	if (write && peek(va).cow())
+		copy_on_write(va);
+	map_view view(pl4te);
+	return imp_iterate((const PDPTE*)view,va,1,fun,reinterpret_cast<qword>(&cursor));
+}
+
 dword user_vspace::write(qword va,const void* data,dword length){
 	if (IS_HIGHADDR(va))
 		return virtual_space::write(va,data,length);
+	//already mapped, skip table walk & map_view
+	if (is_current())
+		return copy_to_user(reinterpret_cast<void*>(va),data,length);
 	lock_guard<rwlock> guard(objlock,rwlock::SHARED);
 	dword count = 0;
 	map_view view;
 	auto sor = static_cast<const byte*>(data);
 	while(count < length){
-		auto pt = peek(va);
-		if (!pt.present || !pt.user || !pt.write)
-			break;
-		view.map(pt.page_addr << 12);
+		qword list[map_view::max_count];
 		auto off = va & PAGE_MASK;
-		auto len = min<dword>(length - count,PAGE_SIZE - off);
+		dword page_count = min<qword>(align_up(off + length - count,PAGE_SIZE)/PAGE_SIZE,map_view::max_count);
+		page_count = imp_gather(va - off,page_count,list,true);
+		if (page_count == 0)
+			break;
+		view.map(list,page_count);
+		auto len = min<qword>(length - count,page_count*PAGE_SIZE - off);
 		auto dst = (byte*)view + off;
 		memcpy(dst,sor,len);
 		sor += len;
@@ -229,17 +828,21 @@ dword user_vspace::write(qword va,const void* data,dword length){
 dword user_vspace::read(qword va,void* buffer,dword length){
 	if (IS_HIGHADDR(va))
 		return virtual_space::read(va,buffer,length);
+	if (is_current())
+		return copy_from_user(buffer,reinterpret_cast<const void*>(va),length);
 	lock_guard<rwlock> guard(objlock,rwlock::SHARED);
 	dword count = 0;
 	map_view view;
 	auto dst = static_cast<byte*>(buffer);
 	while(count < length){
-		auto pt = peek(va);
-		if (!pt.present || !pt.user)
-			break;
-		view.map(pt.page_addr << 12);
+		qword list[map_view::max_count];
 		auto off = va & PAGE_MASK;
-		auto len = min<dword>(length - count,PAGE_SIZE - off);
+		dword page_count = min<qword>(align_up(off + length - count,PAGE_SIZE)/PAGE_SIZE,map_view::max_count);
+		page_count = imp_gather(va - off,page_count,list,false);
+		if (page_count == 0)
+			break;
+		view.map(list,page_count,PAGE_XD);
+		auto len = min<qword>(length - count,page_count*PAGE_SIZE - off);
 		auto sor = (const byte*)view + off;
 		memcpy(dst,sor,len);
 		dst += len;
@@ -252,20 +855,24 @@ dword user_vspace::read(qword va,void* buffer,dword length){
 dword user_vspace::zero(qword va,dword length){
 	if (IS_HIGHADDR(va))
 		return virtual_space::zero(va,length);
+	if (is_current())
+		return zero_user(reinterpret_cast<void*>(va),length);
 	lock_guard<rwlock> guard(objlock,rwlock::SHARED);
 	dword count = 0;
 	map_view view;
 	while(count < length){
-		auto pt = peek(va);
-		if (!pt.present || !pt.user || !pt.write)
-			break;
-		view.map(pt.page_addr << 12);
+		qword list[map_view::max_count];
 		auto off = va & PAGE_MASK;
-		auto len = min<dword>(length - count,PAGE_SIZE - off);
+		dword page_count = min<qword>(align_up(off + length - count,PAGE_SIZE)/PAGE_SIZE,map_view::max_count);
+		page_count = imp_gather(va - off,page_count,list,true);
+		if (page_count == 0)
+			break;
+		view.map(list,page_count);
+		auto len = min<qword>(length - count,page_count*PAGE_SIZE - off);
 		auto dst = (byte*)view + off;
 		zeromemory(dst,len);
 		va += len;
 		count += len;
 	}
 	return count;
-}
\ No newline at end of file
+}
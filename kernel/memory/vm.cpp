@@ -5,37 +5,83 @@
 #include "assert.hpp"
 #include "exception/include/kdb.hpp"
 #include "intrinsics.hpp"
+#include "lock_guard.hpp"
+#include "sysinfo.hpp"
+#include "process/include/core_state.hpp"
 
 using namespace UOS;
 
+//slot window of each core, shared only when cores outnumber windows
+static constexpr unsigned view_window = 0x10;
+static constexpr unsigned window_size = 0x200/view_window;
+static_assert(map_view::max_count <= window_size,"map_view window too small");
+//set as slot in use, one cache line per window
+static struct alignas(0x40) {
+	qword volatile used;
+} view_bitmap[view_window] = {};
+
+static unsigned claim_slot(dword count){
+	assert(count && count <= map_view::max_count);
+	qword mask = ((qword)1 << count) - 1;
+	unsigned home = 0;
+	if (features.get(decltype(features)::PS))
+		home = this_core().index() % view_window;
+	//windows of other cores only when this one is full
+	for (unsigned i = 0;i < view_window;++i){
+		auto group = (home + i) % view_window;
+		auto& bitmap = view_bitmap[group].used;
+		while(true){
+			qword used = bitmap;
+			//bit set where 'count' free slots begin, run stays in window
+			qword run = ~used & (((qword)1 << (window_size - count + 1)) - 1);
+			for (unsigned k = 1;run && k < count;++k)
+				run &= (~used) >> k;
+			if (run == 0)
+				break;
+			auto index = bsf(run);
+			if (used == cmpxchg(&bitmap,used | (mask << index),used))
+				return group*window_size + index;
+		}
+	}
+	bugcheck("map_view::map failed (%d)",count);
+}
+
 map_view::map_view(qword pa,qword attrib){
 	assert(view == nullptr);
-	map(pa,attrib);
+	map(&pa,1,attrib);
+}
+map_view::map_view(const qword* pa_list,dword count,qword attrib){
+	assert(view == nullptr);
+	map(pa_list,count,attrib);
 }
 map_view::~map_view(void){
 	unmap();
 }
 
 void map_view::map(qword pa,qword attrib){
-	assert(0 == (pa & PAGE_MASK));
+	map(&pa,1,attrib);
+}
+
+void map_view::map(const qword* pa_list,dword cnt,qword attrib){
 	assert(0 == (attrib & 0x7FFFFFFFFFFFF004));	//not user, attributes only
 	unmap();
+	auto index = claim_slot(cnt);
 	auto table = (qword volatile* const)MAP_TABLE_BASE;
-	for (unsigned index = 0; index < 0x200; ++index)
-	{
-		qword origin_value = table[index];
+	for (unsigned i = 0;i < cnt;++i){
+		assert(0 == (pa_list[i] & PAGE_MASK));
+		//not global, only cached under CR3 of the holder on its current core
+		qword origin_value = xchg(table + index + i,attrib | pa_list[i] | PAGE_PRESENT);
 		if (origin_value & 0x01)
-			continue;
-
-		qword new_value = attrib | pa | PAGE_PRESENT;
-		auto diff = origin_value ^ cmpxchg(table + index, new_value, origin_value);
-		if (0 == (diff & ~(qword)0x60)){
-			//gain this slot
-			view = (void*)(MAP_VIEW_BASE + PAGE_SIZE * index);
-			return;
-		}
+			bugcheck("map_view slot in use @ %x",index + i);
+	}
+	view = (void*)(MAP_VIEW_BASE + PAGE_SIZE * index);
+	count = cnt;
+	if (features.get(decltype(features)::PS)){
+		//interrupt handlers push and pop their own views on top
+		auto th = this_core().this_thread();
+		next = th->views;
+		th->views = this;
 	}
-	bugcheck("map_view::map failed");
 }
 
 void map_view::unmap(void){
@@ -46,15 +92,97 @@ void map_view::unmap(void){
 	if (addr < MAP_VIEW_BASE)
 		bugcheck("out_of_range %p",view);
 	auto index = (addr - MAP_VIEW_BASE) >> 12;
-	if (index >= 0x200)
+	if (index + count > 0x200)
 		bugcheck("out_of_range %p",view);
 
 	auto table = (qword volatile* const)MAP_TABLE_BASE;
-	qword origin_value = xchg(table + index, (qword)0);
-	if (0 == (origin_value & 0x01))
-		bugcheck("double free @ %x", index);
-	invlpg(view);
+	for (unsigned i = 0;i < count;++i){
+		qword origin_value = xchg(table + index + i, (qword)0);
+		if (0 == (origin_value & 0x01))
+			bugcheck("double free @ %x", index + i);
+		invlpg((byte*)view + PAGE_SIZE*i);
+	}
+	if (features.get(decltype(features)::PS)){
+		//mapped before scheduler started if not found
+		auto link = &this_core().this_thread()->views;
+		while(*link && *link != this)
+			link = &(*link)->next;
+		if (*link)
+			*link = next;
+	}
+	next = nullptr;
+	//slots never cross a window
+	lock_sub(&view_bitmap[index/window_size].used,(((qword)1 << count) - 1) << (index % window_size));
 	view = nullptr;
+	count = 0;
+}
+
+void map_view::invalidate(const map_view* list){
+	for (auto cur = list;cur;cur = cur->next){
+		for (unsigned i = 0;i < cur->count;++i)
+			invlpg((byte*)cur->view + PAGE_SIZE*i);
+	}
+}
+
+void page_source::acquire(void){
+	interrupt_guard<spin_lock> guard(objlock);
+	assert(ref_count);
+	++ref_count;
+}
+
+void page_source::relax(void){
+	{
+		interrupt_guard<spin_lock> guard(objlock);
+		assert(ref_count);
+		if (--ref_count)
+			return;
+	}
+	delete this;
+}
+
+void cow_table::acquire(qword pa){
+	assert(pa && 0 == (pa & PAGE_MASK));
+	interrupt_guard<spin_lock> guard(objlock);
+	auto it = table.find(pa);
+	if (it == table.end())
+		table.insert(pa,2);
+	else
+		++it->count;
+}
+
+void cow_table::relax(qword pa){
+	{
+		interrupt_guard<spin_lock> guard(objlock);
+		auto it = table.find(pa);
+		if (it != table.end()){
+			assert(it->count >= 2);
+			if (--it->count == 1)
+				table.erase(it);
+			//capacity of this reference not needed any more
+			pm.unreserve(1);
+			return;
+		}
+	}
+	pm.release(pa);
+}
+
+qword cow_table::take(qword pa){
+	interrupt_guard<spin_lock> guard(objlock);
+	auto it = table.find(pa);
+	if (it == table.end())
+		return pa;
+	//copied under lock, other owner may write once it sees single reference
+	qword copy;
+	pm.allocate_batch(1,&copy,PM::TAKE);
+	{
+		map_view sor(pa);
+		map_view dst(copy);
+		memcpy((void*)dst,(const void*)sor,PAGE_SIZE);
+	}
+	assert(it->count >= 2);
+	if (--it->count == 1)
+		table.erase(it);
+	return copy;
 }
 
 void virtual_space::BLOCK::get(const PTE* pt){
@@ -188,7 +316,7 @@ void virtual_space::resolve_prior(const PDTE& pdt,const PTE* table,BLOCK& block)
 
 
 word virtual_space::get_max_size(const PDTE& pdt){
-	word remain = pdt.remain;
+	word remain = pdt.remain | (pdt.remain_hi << 3);
 	if (remain < 8)
 		return remain ? (word)1 << (remain - 1) : (word)0;
 	else
@@ -196,16 +324,17 @@ word virtual_space::get_max_size(const PDTE& pdt){
 }
 
 void virtual_space::put_max_size(PDTE& pdt,word max_size){
+	word remain = 0;
 	if (max_size >= 64 + 56)
-		pdt.remain = (word)(7 + (max_size - 64) / 56);
+		remain = (word)(7 + (max_size - 64) / 56);
 	else{
-		word remain = 0;
 		while (max_size){
 			max_size >>= 1;
 			++remain;
 		}
-		pdt.remain = remain;
 	}
+	pdt.remain = remain & 7;
+	pdt.remain_hi = remain >> 3;
 }
 
 void virtual_space::erase(PDTE& pdt,PTE* table,BLOCK& block){
@@ -379,9 +508,9 @@ void virtual_space::check_integrity(PDTE& pdt,PTE* table){
 	for (auto& ele : free_map){
 		assert(!ele);
 	}
-	auto origin_remain = pdt.remain;
+	auto origin_size = get_max_size(pdt);
 	put_max_size(pdt,last_size);
-	assert(pdt.remain == origin_remain);
+	assert(get_max_size(pdt) == origin_size);
 }
 #endif
 
@@ -404,6 +533,7 @@ qword virtual_space::imp_reserve_any(PDTE& pdt,PTE* table,qword base_addr,word c
 			for (unsigned i = 0;i < count;++i){
 				assert(!table[allocated_block + i].present && !table[allocated_block + i].preserve);
 				table[allocated_block + i].preserve = 1;
+				table[allocated_block + i].valid = 0;
 			}
 			block.size -= count;
 			insert(pdt,table,block);
@@ -434,6 +564,7 @@ bool virtual_space::imp_reserve_fixed(PDTE& pdt,PTE* table,word index,word count
 	for (unsigned i = 0;i < count;++i){
 		assert(!table[index + i].present && !table[index + i].preserve);
 		table[index + i].preserve = 1;
+		table[index + i].valid = 0;
 	}
 	blocks[1].size = blocks[0].size + blocks[0].self;
 	blocks[1].self = index + count;
@@ -519,6 +650,11 @@ void virtual_space::imp_release(PDTE& pdt,PTE* table,qword base_addr,word count)
 			invlpg((void*)addr);
 			--used_pages;
 		}
+		else if (cur.lazy()){
+			cur.valid = 0;
+			pm.unreserve(1);
+			--used_pages;
+		}
 		else if (!cur.preserve){
 			bugcheck("double release %p",addr);
 		}
@@ -558,10 +694,26 @@ dword virtual_space::imp_iterate(const PDPTE* pdpt_table,qword base_addr,dword p
             if (cur.bypass || !cur.present){
                 return count;
             }
-            pt_view.map(cur.pt_addr << 12);
-            PTE* table = (PTE*)pt_view;
+			PTE* table = nullptr;
+			if (!cur.ps){
+				pt_view.map(cur.pt_addr << 12);
+				table = (PTE*)pt_view;
+			}
             while(off < 0x200){
-				if (!callback(table[off],addr,data))
+				if (table == nullptr){
+					//2M page, split only if callback changes the entry
+					auto pt = large_entry(cur,off);
+					auto origin = pt;
+					if (!callback(pt,addr,data))
+						return count;
+					if (*reinterpret_cast<qword*>(&pt) != *reinterpret_cast<qword*>(&origin)){
+						imp_split(cur,pt_view);
+						table = (PTE*)pt_view;
+						table[off] = pt;
+						invlpg((void*)addr);
+					}
+				}
+				else if (!callback(table[off],addr,data))
 					return count;
 				addr += PAGE_SIZE;
 				++off;
@@ -598,6 +750,10 @@ PTE virtual_space::imp_peek(qword va,PDPTE const* pdpt_table){
 		auto pdt_table = (PDTE*)pdt_view;
 		if (!pdt_table[pdt_index].present)
 			break;
+		if (pdt_table[pdt_index].ps){
+			pt = large_entry(pdt_table[pdt_index],pt_index);
+			break;
+		}
 		map_view pt_view(pdt_table[pdt_index].pt_addr << 12);
 		auto pt_table = (PTE*)pt_view;
 		pt = pt_table[pt_index];
@@ -607,6 +763,133 @@ PTE virtual_space::imp_peek(qword va,PDPTE const* pdpt_table){
 	return pt;
 }
 
+PTE virtual_space::large_entry(const PDTE& pdt,word index){
+	assert(pdt.present && pdt.ps && index < 0x200);
+	PTE pt = {0};
+	pt.present = 1;
+	pt.write = pdt.write;
+	pt.user = pdt.user;
+	pt.wt = pdt.wt;
+	pt.cd = pdt.cd;
+	pt.global = pdt.global;
+	pt.page_addr = pdt.pt_addr + index;
+	pt.data = pdt.head;
+	pt.preserve = 1;
+	pt.bypass = pdt.bypass;
+	pt.xd = pdt.xd;
+	return pt;
+}
+
+void virtual_space::imp_split(PDTE& pdt,map_view& view){
+	assert(is_locked());
+	assert(pdt.present && pdt.ps && !pdt.bypass);
+	//capacity reserved since imp_merge
+	auto pa = pm.allocate(PM::TAKE);
+	view.map(pa);
+	PTE* table = (PTE*)view;
+	for (unsigned i = 0;i < 0x200;++i)
+		table[i] = large_entry(pdt,i);
+	//no free block, same as new_pt otherwise
+	PDTE val = {0};
+	val.pt_addr = pa >> 12;
+	val.user = 1;
+	val.write = 1;
+	val.present = 1;
+	pdt = val;
+}
+
+bool virtual_space::imp_merge(PDTE& pdt,const PTE* table,qword base_addr){
+	assert(is_locked());
+	assert(pdt.present && !pdt.ps && !pdt.bypass);
+	assert(0 == (base_addr & 0x1FFFFF));
+	const auto& first = table[0];
+	//bypass PDTE marks unmanaged range, imp_iterate stops there
+	if (!first.present || !first.preserve || first.bypass || first.valid || first.pat || (first.page_addr & 0x1FF))
+		return false;
+	//accessed, dirty & free block type ignored
+	constexpr qword mask = ~(qword)0x660;
+	const qword head = *reinterpret_cast<const qword*>(&first) & mask;
+	for (unsigned i = 1;i < 0x200;++i){
+		if ((*reinterpret_cast<const qword*>(table + i) & mask) != head + ((qword)i << 12))
+			return false;
+	}
+	//kept for imp_split
+	if (!pm.reserve(1))
+		return false;
+	PDTE val = {0};
+	val.present = 1;
+	val.write = first.write;
+	val.user = first.user;
+	val.wt = first.wt;
+	val.cd = first.cd;
+	val.ps = 1;
+	val.global = first.global;
+	val.pt_addr = first.page_addr;
+	val.head = first.data;
+	val.xd = first.xd;
+	auto pa = pdt.pt_addr << 12;
+	pdt = val;
+	//also drops cached walk through old table
+	invlpg((void*)base_addr);
+	if (!IS_HIGHADDR(base_addr)){
+		//PT window of current vspace may still map old table
+		invlpg((void*)(PT_WINDOW_BASE + (base_addr >> 21)*PAGE_SIZE));
+	}
+	if (IS_HIGHADDR(base_addr) && features.get(decltype(features)::PCID)){
+		//walk may be cached under other PCIDs, toggling PGE drops them all
+		auto cr4 = read_cr4();
+		write_cr4(cr4 & ~(qword)0x80);
+		write_cr4(cr4);
+	}
+	pm.release(pa);
+	return true;
+}
+
+bool virtual_space::promote(const PDPTE* pdpt_table,qword addr){
+	assert(is_locked());
+	assert(0 == (addr & 0x1FFFFF));
+	if (LOWADDR(addr) >> 39)
+		return false;
+	const auto& pdpt = pdpt_table[(addr >> 30) & 0x1FF];
+	if (!pdpt.present)
+		return false;
+	map_view pdt_view(pdpt.pdt_addr << 12);
+	auto& pdt = ((PDTE*)pdt_view)[(addr >> 21) & 0x1FF];
+	if (!pdt.present || pdt.ps || pdt.bypass)
+		return false;
+	map_view pt_view(pdt.pt_addr << 12);
+	return imp_merge(pdt,(const PTE*)pt_view,addr);
+}
+
+void virtual_space::commit_large(const PDPTE* pdpt_table,qword addr,qword pa,bool user){
+	assert(is_locked());
+	assert(0 == (addr & 0x1FFFFF) && pa && 0 == (pa & 0x1FFFFF));
+	struct cursor_t{
+		qword pa;
+		bool user;
+	} cursor = {pa,user};
+	auto res = imp_iterate(pdpt_table,addr,0x200,[](PTE& pt,qword addr,qword data) -> bool{
+		auto cursor = (const cursor_t*)data;
+		assert(pt.preserve && !pt.bypass && !pt.present);
+		//single store, see user_vspace::fault_in
+		PTE val = pt;
+		val.page_addr = (cursor->pa >> 12) + ((addr >> 12) & 0x1FF);
+		val.xd = 1;
+		val.pat = 0;
+		val.user = cursor->user ? 1 : 0;
+		val.global = cursor->user ? 0 : 1;
+		val.write = 1;
+		val.data = 0;
+		val.valid = 0;
+		val.present = 1;
+		pt = val;
+		return true;
+	},reinterpret_cast<qword>(&cursor));
+	if (res != 0x200)
+		bugcheck("page count mismatch (%x,%x)",res,0x200);
+	promote(pdpt_table,addr);
+}
+
 bool virtual_space::new_pdt(PDPTE& pdpt,map_view& view){
 	assert(!pdpt.present);
 	auto phy_addr = pm.allocate();
@@ -626,6 +909,53 @@ bool virtual_space::new_pdt(PDPTE& pdpt,map_view& view){
 	return true;
 }
 
+void virtual_space::commit_reserved(const PDPTE* pdpt_table,qword base_addr,dword page_count,bool user){
+	assert(is_locked());
+	struct cursor_t{
+		qword list[0x40];
+		dword index;
+		bool user;
+	} cursor;
+	cursor.user = user;
+	PTE_CALLBACK fun = [](PTE& pt,qword,qword data) -> bool{
+		auto cursor = (cursor_t*)data;
+		assert(pt.preserve && !pt.bypass && !pt.present);
+		pt.page_addr = cursor->list[cursor->index++] >> 12;
+		pt.xd = 1;
+		pt.pat = 0;
+		pt.user = cursor->user ? 1 : 0;
+		//kernel half global, see kernel_vspace::kernel_vspace
+		pt.global = cursor->user ? 0 : 1;
+		pt.write = 1;
+		pt.present = 1;
+		return true;
+	};
+	//no aligned run once allocate_large fails, skip later attempts
+	bool large = true;
+	while(page_count){
+		if (large && 0 == (base_addr & 0x1FFFFF) && page_count >= 0x200){
+			auto pa = pm.allocate_large(PM::TAKE);
+			if (pa){
+				commit_large(pdpt_table,base_addr,pa,user);
+				base_addr += 0x200*PAGE_SIZE;
+				page_count -= 0x200;
+				continue;
+			}
+			large = false;
+		}
+		//batch never crosses 2M boundary, so later ranges stay aligned
+		dword count = min<dword>(page_count,sizeof(cursor.list)/sizeof(qword));
+		count = min<dword>(count,0x200 - ((base_addr >> 12) & 0x1FF));
+		pm.allocate_batch(count,cursor.list,PM::TAKE,true);
+		cursor.index = 0;
+		auto res = imp_iterate(pdpt_table,base_addr,count,fun,reinterpret_cast<qword>(&cursor));
+		if (res != count)
+			bugcheck("page count mismatch (%x,%x)",res,count);
+		base_addr += count*PAGE_SIZE;
+		page_count -= count;
+	}
+}
+
 bool virtual_space::new_pt(PDTE& pdt,map_view& view,bool take){
 	assert(!pdt.present && !pdt.bypass);
 	auto phy_addr = pm.allocate(take ? PM::TAKE : PM::NONE);
@@ -665,7 +995,7 @@ qword virtual_space::reserve_any(PDPTE* pdpt_table,dword page_count){
 		PDTE* pdt_table = (PDTE*)pdt_view;
 		for (unsigned i = 0;i < 0x200;++i){
 			auto& cur = pdt_table[i];
-			if (cur.bypass)
+			if (cur.bypass || cur.ps)
 				continue;
 			if (!cur.present){  //allocate new PTE
 				if (!new_pt(cur,pt_view,false))
@@ -709,7 +1039,7 @@ bool virtual_space::reserve_fixed(PDPTE* pdpt_table,qword base_addr,dword page_c
 		PDTE* pdt_table = (PDTE*)pdt_view;
 		while(count < page_count){
 			auto& cur = pdt_table[pdt_index];
-			if (cur.bypass){
+			if (cur.bypass || cur.ps){
 				goto rollback;
 			}
 			if (!cur.present){
@@ -763,7 +1093,7 @@ qword virtual_space::reserve_big(PDPTE* pdpt_table,dword pagecount){
 		dword reserve_count = 0;
 		for (unsigned i = 0;i < 0x200;++i){
 			auto& cur = pdt_table[i];
-			if (cur.bypass || (cur.present && get_max_size(cur) != 0x200)){
+			if (cur.bypass || cur.ps || (cur.present && get_max_size(cur) != 0x200)){
 				avl_base = i + 1;
 				avl_pages = 0;
 				reserve_count = 0;
@@ -837,7 +1167,10 @@ bool virtual_space::safe_release(PDPTE* pdpt_table,qword base_addr,dword page_co
 			if (cur.bypass || !cur.present){
 				bugcheck("cannot release page %x",cur);
 			}
-			pt_view.map(cur.pt_addr << 12);
+			if (cur.ps)
+				imp_split(cur,pt_view);
+			else
+				pt_view.map(cur.pt_addr << 12);
 			PTE* table = (PTE*)pt_view;
 			dword off = (addr >> 12) & 0x1FF;
 			auto size = min(page_count - count,0x200 - off);
@@ -857,6 +1190,46 @@ bool virtual_space::safe_release(PDPTE* pdpt_table,qword base_addr,dword page_co
 	return (count == page_count);
 }
 
+extern "C" qword user_copy(void* dst,const void* sor,qword length);
+extern "C" qword user_zero(void* dst,qword length);
+
+//part of [va,va + length) within user space
+static inline dword user_range(qword va,dword length){
+	constexpr auto top = virtual_space::size_512G;
+	if (va >= top)
+		return 0;
+	return min<qword>(length,top - va);
+}
+
+dword UOS::copy_to_user(void* dst,const void* sor,dword length){
+	auto len = user_range(reinterpret_cast<qword>(dst),length);
+	if (len == 0)
+		return 0;
+	auto left = user_copy(dst,sor,len);
+	return len - left;
+}
+
+dword UOS::copy_from_user(void* dst,const void* sor,dword length){
+	auto len = user_range(reinterpret_cast<qword>(sor),length);
+	if (len == 0)
+		return 0;
+	auto left = user_copy(dst,sor,len);
+	return len - left;
+}
+
+dword UOS::zero_user(void* dst,dword length){
+	auto len = user_range(reinterpret_cast<qword>(dst),length);
+	if (len == 0)
+		return 0;
+	auto left = user_zero(dst,len);
+	return len - left;
+}
+
+bool virtual_space::is_current(void) const{
+	//low bits of CR3 not part of table address
+	return (read_cr3() & ~PAGE_MASK) == get_cr3();
+}
+
 dword virtual_space::write(qword va,const void* data,dword length){
 	memcpy(reinterpret_cast<void*>(va),data,length);
 	return length;
@@ -13,19 +13,29 @@ using namespace UOS;
 
 constexpr byte scheduler::max_slice;
 constexpr byte scheduler::max_priority;
+constexpr byte scheduler::idle_priority;
 
 thread* scheduler::get(byte level){
 	level = min(level,max_priority);
 	interrupt_guard<spin_lock> guard(lock);
-	for (unsigned i = 0;i < level;++i){
-		auto th = ready_queue[i].get();
-		if (th){
-			//dbgprint("selected thread#%d(%d) from %p",th->get_id(),th->get_priority(),return_address());
-			return th;
-		}
+	dword mask = ready_mask & ((1U << level) - 1);
+	if (0 == mask){
+		//dbgprint("selected thread<none> from %p",return_address());
+		return nullptr;
 	}
-	//dbgprint("selected thread<none> from %p",return_address());
-	return nullptr;
+	auto index = bsf(mask);
+	thread* th;
+	bool fair = false;
+	if (index == user_priority && !fair_queue.empty()){
+		fair = ready_queue[index].empty() || fair_turn;
+		fair_turn = !fair_turn;
+	}
+	th = fair ? get_fair() : ready_queue[index].get();
+	assert(th);
+	if (ready_queue[index].empty() && (index != user_priority || fair_queue.empty()))
+		ready_mask &= ~(1U << index);
+	//dbgprint("selected thread#%d(%d) from %p",th->get_id(),th->get_priority(),return_address());
+	return th;
 }
 
 void scheduler::put(thread* th){
@@ -33,64 +43,366 @@ void scheduler::put(thread* th){
 	assert(th->get_state() == thread::READY);
 	byte index = th->priority;
 	assert(index < max_priority);
+	auto ps = th->get_process();
 	interrupt_guard<spin_lock> guard(lock);
-	ready_queue[index].put(th);
+	if (index == user_priority && ps->share){
+		//woken process gets at most one slice of credit
+		auto floor = fair_floor;
+		if (ps->vruntime + slice_us < floor)
+			ps->vruntime = floor - slice_us;
+		fair_queue.put(th);
+	}
+	else
+		ready_queue[index].put(th);
+	ready_mask |= (1U << index);
 	//dbgprint("queued thread#%d(%d) from %p",th->get_id(),index,return_address());
 }
 
-core_manager::core_manager(void){
+//lowest vruntime first, few threads in queue
+thread* scheduler::get_fair(void){
+	assert(lock.is_locked());
+	thread* sel = nullptr;
+	thread* sel_prev = nullptr;
+	qword sel_vruntime = 0;
+	thread* prev = nullptr;
+	for (auto th = fair_queue.head;th;prev = th,th = thread_queue::next(th)){
+		qword vruntime = th->get_process()->vruntime;
+		if (sel == nullptr || vruntime < sel_vruntime){
+			sel = th;
+			sel_prev = prev;
+			sel_vruntime = vruntime;
+		}
+	}
+	assert(sel);
+	fair_queue.erase(sel,sel_prev);
+	fair_floor = max(fair_floor,sel_vruntime);
+	return sel;
+}
+
+//filled by BSP at the tail of AP trampoline, see hal.asm
+struct ap_info{
+	qword cr0;
+	qword cr3;
+	qword cr4;
+	qword entry;
+	qword stack;
+	qword arg;
+};
+
+core_manager::core_manager(void) : active(1), tlb_gen(0) {
 	count = acpi.get_madt()->processors.size();
-	assert(count);
+	assert(count && count <= max_core);
 	pm.set_mp_count(count);
 	core_list = (core_state**)operator new(sizeof(core_state*)*count);
 	zeromemory(core_list,sizeof(core_state*)*count);
 	//set up core_state for BSP
+	auto ps = proc.find(0,false);
+	assert(ps);
+	auto th = ps->find(0,false);
+	assert(th);
+	auto self = new_core(apic.id(),0,th);
+	self->fpu_owner = th;
+	core_list[0] = self;
+	load_core(self);
+
+	apic.set(APIC::IRQ_CONTEXT_TRAP,this_core::irq_switch_to,nullptr);
+	apic.set(APIC::IRQ_IPI,on_ipi,nullptr);
+	apic.set(APIC::IRQ_TLB,on_shootdown,nullptr);
+	apic.set(APIC::IRQ_RESCHED,on_resched,nullptr);
+	self->online = true;
+
+	if (count > 1)
+		start_ap();
+
+	//slice tick driven by heartbeat
+	timer.set_tick(scheduler::slice_us,on_timer,this);
+	features.set(decltype(features)::PS);
+}
+
+core_state* core_manager::new_core(word uid,word index,thread* th){
 	auto va = vm.reserve(0,3);
 	if (!va)
 		bugcheck("vm.reserve failed with 3 pages");
 	auto res = vm.commit(va,1) && vm.commit(va + 2*PAGE_SIZE,1);
 	if (!res)
 		bugcheck("vm.commit failed @ %p",va);
-	core_list[0] = (core_state*)va;
-	auto& self = *core_list[0];
-	self.uid = apic.id();
-	auto ps = proc.find(0,false);
-	assert(ps);
-	auto th = ps->find(0,false);
-	assert(th);
-	self.this_thread = th;
-	self.fpu_owner = th;
-	self.gc_ptr = nullptr;
-	build_TSS(&self.tss,va + 3*PAGE_SIZE,va + PAGE_SIZE,FATAL_STK_TOP);
+	auto self = (core_state*)va;
+	self->uid = uid;
+	self->index = index;
+	self->this_thread = th;
+	self->fpu_owner = nullptr;
+	self->gc_ptr = nullptr;
+	self->switch_stk = reinterpret_cast<qword>(self->switch_area);
+	self->self = self;
+	self->idle_time = 0;
+	self->busy_time = 0;
+	zeromemory(&self->stat,sizeof(SCHED_STAT));
+	zeromemory(self->pcid_slot,sizeof(self->pcid_slot));
+	self->pcid_victim = 0;
+	self->online = false;
+	self->tlb_req = 0;
+	self->tlb_seen = 0;
+	self->space = &vm;
+	new (&self->ready_queue) scheduler();
+	return self;
+}
+
+//called on the target core
+void core_manager::load_core(core_state* self){
+	auto va = reinterpret_cast<qword>(self);
+	build_TSS(&self->tss,va + 3*PAGE_SIZE,FATAL_STK_TOP);
 	wrmsr(MSR_GS_BASE,va);
-	//set up SYSCALL for BSP
+	//set up SYSCALL
 	qword STAR_value = (qword)(((SEG_USER_CS - 16) << 16) | (SEG_KRNL_CS)) << 32;
 	qword SFMASK_value = 0x700;	//masks IF & DF & TF (to protect GSBASE)
 	wrmsr(MSR_STAR,STAR_value);
 	wrmsr(MSR_LSTAR,(qword)service_entry);
 	wrmsr(MSR_SFMASK,SFMASK_value);
+}
 
-	apic.set(APIC::IRQ_CONTEXT_TRAP,this_core::irq_switch_to,nullptr);
+void core_manager::start_ap(void){
+	auto pdpt0 = (qword volatile*)HIGHADDR(PDPT0_PBASE);
+	auto pt0 = (qword volatile*)HIGHADDR(PT0_PBASE);
+	constexpr auto ap_index = AP_ENTRY_PBASE >> 12;
+	//identity map trampoline as executable during AP startup
+	assert(pdpt0[0] == 0 && 0 == (pt0[ap_index] & PAGE_PRESENT));
+	qword pte = pt0[ap_index];
+	pt0[ap_index] = AP_ENTRY_PBASE | PAGE_WRITE | PAGE_PRESENT;
+	pdpt0[0] = PDT0_PBASE | PAGE_WRITE | PAGE_PRESENT;
+	invlpg((void*)HIGHADDR(AP_ENTRY_PBASE));
 
-	//set up periodic timer here
-	timer_ticket = timer.wait(scheduler::slice_us,on_timer,this,true);
-	features.set(decltype(features)::PS);
+	size_t size = ap_trampoline_end - ap_trampoline;
+	assert(size >= sizeof(ap_info) && size <= PAGE_SIZE);
+	auto base = (byte*)HIGHADDR(AP_ENTRY_PBASE);
+	memcpy(base,ap_trampoline,size);
+	auto info = (ap_info volatile*)(base + size - sizeof(ap_info));
+	info->cr0 = read_cr0() & ~(qword)0x08;	//TS
+	info->cr3 = read_cr3();
+	//PCIDE only allowed in long mode, set in ap_entry
+	info->cr4 = read_cr4() & ~((qword)1 << 17);
+	info->entry = reinterpret_cast<qword>(ap_entry);
+
+	auto ps = proc.find(0,false);
+	assert(ps);
+	unsigned index = 1;
+	for (auto& p : acpi.get_madt()->processors){
+		if (p.apic_id == core_list[0]->uid)
+			continue;
+		assert(index < count);
+		auto th = ps->spawn_idle();
+		assert(th);
+		auto ap = new_core(p.apic_id,index,th);
+		core_list[index++] = ap;
+		info->stack = th->krnl_stk_top;
+		info->arg = reinterpret_cast<qword>(ap);
+
+		auto cur = active;
+		//INIT-SIPI-SIPI
+		apic.send_ipi(p.apic_id,0x4500);
+		delay_us(10*1000);
+		for (unsigned i = 0;i < 2 && active == cur;++i){
+			apic.send_ipi(p.apic_id,0x4600 | ap_index);
+			delay_us(200);
+		}
+		for (unsigned i = 0;active == cur;++i){
+			if (i >= 100)	//about 100ms
+				bugcheck("CPU#%d APICid#%d not responding",p.uid,p.apic_id);
+			delay_us(1000);
+		}
+	}
+	pdpt0[0] = 0;
+	pt0[ap_index] = pte;
+	invlpg((void*)HIGHADDR(AP_ENTRY_PBASE));
+	invlpg((void*)AP_ENTRY_PBASE);
+	dbgprint("%d of %d processors active",active,count);
+}
+
+void core_manager::ap_entry(qword ptr){
+	auto self = reinterpret_cast<core_state*>(ptr);
+	if (features.get(decltype(features)::PCID))
+		write_cr4(read_cr4() | (1 << 17));
+	fpu.setup_local();
+	fpu_init();
+	load_core(self);
+	apic.setup_local();
+	{
+		this_core core;
+		assert(core.this_thread() == self->this_thread);
+	}
+	lock_add(&cores.active,(dword)1);
+	self->tlb_seen = cores.tlb_gen;
+	self->online = true;
+	sti();
+
+	//as idle thread
+	while(true){
+		cores.idle();
+	}
 }
 
 core_state* core_manager::get(void){
 	auto id = apic.id();
 	for (unsigned i = 0;i < count;++i){
-		if (core_list[i]->uid == id)
+		if (core_list[i] && core_list[i]->uid == id)
 			return core_list[i];
 	}
 	return nullptr;
 }
 
-void core_manager::on_timer(qword ticket,void* ptr){
+void core_manager::put(thread* th){
+	this_core core;
+	bool busy = th->get_priority() < scheduler::idle_priority;
+	core.ready_queue().put(th);
+	if (!busy)
+		return;
+	//restart slice tick, pairs with idle()
+	timer.tick(true);
+	if (active <= 1 || core.this_thread()->get_priority() >= scheduler::idle_priority)
+		return;
+	//this core is busy, wake one idle sibling to steal the thread
+	auto self = core.self();
+	for (unsigned i = 0;i < count;++i){
+		auto other = core_list[i];
+		if (other == nullptr || other == self || !other->online)
+			continue;
+		if (other->this_thread->get_priority() >= scheduler::idle_priority){
+			apic.send_ipi(other->uid,0x4000 | APIC::IRQ_RESCHED);
+			break;
+		}
+	}
+}
+
+void core_manager::idle(void){
+	this_core core;
+	cli();
+	if (core.id() == core_list[0]->uid){
+		//only BSP owns the slice tick
+		timer.tick(false);
+		bool busy = false;
+		for (unsigned i = 0;i < count;++i){
+			auto other = core_list[i];
+			if (other == nullptr)
+				continue;
+			if (other->this_thread->get_priority() < scheduler::idle_priority \
+				|| other->ready_queue.ready(scheduler::idle_priority))
+			{
+				busy = true;
+				break;
+			}
+		}
+		if (busy)
+			timer.tick(true);
+		else
+			timer.suspend();
+	}
+	sti_hlt();
+}
+
+thread* core_manager::pick(byte level){
+	this_core core;
+	auto& local = core.ready_queue();
+	//idle threads stay in their own core
+	byte steal_level = min(level,scheduler::idle_priority);
+	auto th = local.get(steal_level);
+	if (th)
+		return th;
+	for (unsigned i = 0;i < count;++i){
+		auto other = core_list[i];
+		if (other == nullptr || &other->ready_queue == &local)
+			continue;
+		th = other->ready_queue.get(steal_level);
+		if (th)
+			return th;
+	}
+	return (level > steal_level) ? local.get(level) : nullptr;
+}
+
+void core_manager::on_timer(qword,void* ptr){
 	IF_assert;
 	auto self = (core_manager*)ptr;
-	if (self->timer_ticket != ticket)
-		bugcheck("core_manager ticket mismatch (%x,%x)",ticket,self->timer_ticket);
+	if (self->active > 1){
+		//slice tick for other processors
+		apic.broadcast(APIC::IRQ_IPI);
+	}
+	on_slice();
+}
+
+bool core_manager::on_ipi(byte,void*){
+	on_slice();
+	return false;
+}
+
+//idle core picks up threads queued elsewhere on return
+bool core_manager::on_resched(byte,void*){
+	return true;
+}
+
+bool core_manager::on_shootdown(byte,void*){
+	flush_tlb(this_core().self());
+	return false;
+}
+
+//generation read before taking requests, a request missed here
+//was bumped later and is served by the IPI following it
+void core_manager::flush_tlb(core_state* self){
+	auto gen = cores.tlb_gen;
+	if (self->tlb_seen == gen)
+		return;
+	auto req = xchg<byte>(&self->tlb_req,0);
+	if (req & TLB_ALL){
+		//toggling PGE drops global entries and every PCID
+		auto cr4 = read_cr4();
+		write_cr4(cr4 & ~(qword)0x80);
+		write_cr4(cr4);
+	}
+	else if (req & TLB_SPACE){
+		//reload drops current PCID only, others checked on switch by generation
+		write_cr3(read_cr3());
+	}
+	self->tlb_seen = gen;
+}
+
+void core_manager::shootdown(const virtual_space* vspace){
+	if (active <= 1)
+		return;
+	interrupt_guard<void> ig;
+	auto self = this_core().self();
+	byte req = vspace ? TLB_SPACE : TLB_ALL;
+	//cores switching to 'vspace' later see its new generation instead
+	qword target[max_core/64] = {0};
+	for (unsigned i = 0;i < count;++i){
+		auto other = core_list[i];
+		if (other == nullptr || other == self || !other->online)
+			continue;
+		if (vspace && other->space != vspace)
+			continue;
+		lock_or(&other->tlb_req,req);
+		target[i/64] |= (qword)1 << (i % 64);
+	}
+	qword gen;
+	do{
+		gen = tlb_gen;
+	}while(gen != cmpxchg<qword>(&tlb_gen,gen + 1,gen));
+	++gen;
+	for (unsigned i = 0;i < count;++i){
+		if (target[i/64] & ((qword)1 << (i % 64)))
+			apic.send_ipi(core_list[i]->uid,0x4000 | APIC::IRQ_TLB);
+	}
+	for (unsigned i = 0;i < count;++i){
+		if (0 == (target[i/64] & ((qword)1 << (i % 64))))
+			continue;
+		auto other = core_list[i];
+		//signed compare, the core may have flushed for a later request
+		while((long long)(other->tlb_seen - gen) < 0){
+			//concurrent sender may wait on this core with interrupts off
+			flush_tlb(self);
+			mm_pause();
+		}
+	}
+}
+
+void core_manager::on_slice(void){
+	IF_assert;
 	this_core core;
 	auto this_thread = core.this_thread();
 	assert(this_thread->has_context());
@@ -104,6 +416,7 @@ void core_manager::on_timer(qword ticket,void* ptr){
 		}
 		else{
 			this_thread->put_slice(scheduler::max_slice);
+			this_thread->account(&SCHED_STAT::slice_count);
 		}
 	}
 	preempt(slice == 0);
@@ -116,7 +429,7 @@ void core_manager::preempt(bool lower){
 	thread* next_thread;
 	bool need_gc = false;
 	do{
-		next_thread = ready_queue.get(this_thread->get_priority() + lower);
+		next_thread = cores.pick(this_thread->get_priority() + lower);
 		if (!next_thread)
 			break;
 		next_thread->lock();
@@ -133,7 +446,7 @@ void core_manager::preempt(bool lower){
 		assert(next_thread->is_locked());
 		this_thread->lock();
 		if (this_thread->set_state(thread::READY)){
-			ready_queue.put(this_thread);
+			cores.put(this_thread);
 		}
 		// this_thread->on_stop called in escape
 		// gc signaled on escape
@@ -143,7 +456,7 @@ void core_manager::preempt(bool lower){
 	else if (this_thread->get_state() == thread::STOPPED){
 		need_gc = false;
 		do{
-			next_thread = ready_queue.get();
+			next_thread = cores.pick();
 			if (!next_thread)
 				bugcheck("no ready thread");
 			next_thread->lock();
@@ -167,13 +480,74 @@ this_core::this_core(void){
 }
 #endif
 
+//with PCID, TLB of recently used vspace kept across switch
+void this_core::switch_space(virtual_space* vspace){
+	//published before reading generation, see core_manager::shootdown
+	xchg_ptr(&this_core().self()->space,vspace);
+	auto cr3 = vspace->get_cr3();
+	if (!features.get(decltype(features)::PCID)){
+		write_cr3(cr3);
+		return;
+	}
+	constexpr qword no_flush = (qword)1 << 63;
+	if (vspace == &vm){
+		//kernel half global except map_view, PCID 0 never flushed
+		write_cr3(cr3 | no_flush);
+		return;
+	}
+	auto uvs = static_cast<user_vspace*>(vspace);
+	this_core core;
+	auto self = core.self();
+	auto uid = uvs->id();
+	auto gen = uvs->generation();
+	unsigned index = 0;
+	while(index < 8 && self->pcid_slot[index].uid != uid)
+		++index;
+	bool stale = true;
+	if (index == 8){
+		//evict round robin, slot reused with flush
+		index = self->pcid_victim;
+		self->pcid_victim = (index + 1) % 8;
+		self->pcid_slot[index].uid = uid;
+	}
+	else
+		stale = (self->pcid_slot[index].gen != gen);
+	self->pcid_slot[index].gen = gen;
+	write_cr3(cr3 | (index + 1) | (stale ? 0 : no_flush));
+}
+
 bool this_core::irq_switch_to(byte,void* data){
 	thread* cur_thread = reinterpret_cast<thread*>(
 			read_gs<qword>(offsetof(core_state,this_thread))
 	);
 	assert(cur_thread->has_context());
 	auto time_tick = timer.running_time();
-	lock_add(&cur_thread->get_process()->cpu_time,time_tick - cur_thread->slice_timestamp);
+	auto slice_time = time_tick - cur_thread->slice_timestamp;
+	auto cur_process = cur_thread->get_process();
+	lock_add(&cur_process->cpu_time,slice_time);
+	{
+		dword share = cur_process->share;
+		if (share && cur_thread->get_priority() == scheduler::user_priority)
+			lock_add(&cur_process->vruntime,slice_time*scheduler::default_share/share);
+	}
+	{
+		this_core core;
+		auto self = core.self();
+		if (cur_thread->get_priority() == scheduler::idle_priority)
+			self->idle_time += slice_time;
+		else
+			self->busy_time += slice_time;
+	}
+	switch(cur_thread->get_state()){
+		case thread::READY:
+			cur_thread->account(&SCHED_STAT::preempt_count);
+			break;
+		case thread::WAITING:
+			cur_thread->account(&SCHED_STAT::switch_count);
+			break;
+		default:
+			break;
+	}
 
 	bool need_gc = (cur_thread->get_state() == thread::STOPPED);
 	//gc step
@@ -204,16 +578,44 @@ bool this_core::irq_switch_to(byte,void* data){
 	if (gc_th)
 		gc.signal(target);
 	target->slice_timestamp = time_tick;
+	if (target->ready_timestamp){
+		target->account(&SCHED_STAT::wait_time,time_tick - target->ready_timestamp);
+		target->ready_timestamp = 0;
+	}
 
+	//views of cur_thread may be touched on other core next time
+	if (cur_thread->views)
+		map_view::invalidate(cur_thread->views);
 	process* ps = target->get_process();
 	if (cur_thread->get_process() != ps){
-		//change CR3
-		write_cr3(ps->vspace->get_cr3());
+		switch_space(ps->vspace);
+	}
+
+	auto owner = reinterpret_cast<thread*>(read_gs<qword>(offsetof(core_state,fpu_owner)));
+	if (cur_thread == owner && cores.size() > 1){
+		//cur_thread may resume on another core, FPU state cannot stay here
+		cur_thread->save_sse();
+		owner = nullptr;
 	}
 
-	//set CR0.TS
 	auto cr0 = read_cr0();
-	write_cr0(cr0 | 0x08);
+	bool eager = target->fpu_eager();
+	target->fpu_switch();
+	if (eager){
+		//FPU heavy thread, restore now rather than trap
+		write_cr0(cr0 & ~(qword)0x08);
+		if (owner != target){
+			if (owner)
+				owner->save_sse();
+			target->load_sse();
+			owner = target;
+		}
+	}
+	else{
+		//set CR0.TS
+		write_cr0(cr0 | 0x08);
+	}
+	write_gs(offsetof(core_state,fpu_owner),reinterpret_cast<qword>(owner));
 
 	write_gs(offsetof(core_state,this_thread),reinterpret_cast<qword>(target));
 	target->unlock();
@@ -242,7 +644,8 @@ void this_core::gc_step(void){
 */
 void this_core::switch_to(thread* th){
 	IF_assert;
-	assert(th && th->is_locked() && th->has_context());
+	//context may still being saved on other core
+	assert(th && th->is_locked() && (th->has_context() || th->on_core));
 	assert(th->get_state() == thread::RUNNING);
 	//assert(this_thread()->get_state() != thread::RUNNING);
 	//gc_step();
@@ -301,6 +704,41 @@ void gc_service::signal(thread* target){
 		ev.signal_one();
 }
 
+zero_service::zero_service(void){
+	this_core core;
+	auto this_process = core.this_thread()->get_process();
+	qword args[4] = {reinterpret_cast<qword>(this)};
+	th_zero = this_process->spawn(thread_zero,args);
+}
+
+void zero_service::signal(void){
+	//PM may call before construction
+	//state stays set, so a signal before wait is not lost
+	if (th_zero)
+		ev.signal_all();
+}
+
+void zero_service::thread_zero(qword arg,qword,qword,qword){
+	{
+		this_core core;
+		//just above idle threads, or idle() would stop the tick under it
+		core.this_thread()->set_priority(scheduler::idle_priority - 1);
+	}
+	auto self = reinterpret_cast<zero_service*>(arg);
+	map_view view;
+	while(true){
+		//reset before checking, later signal keeps wait from blocking
+		self->ev.reset();
+		qword pa;
+		while(0 != (pa = pm.zero_pick())){
+			view.map(pa);
+			zeromemory((void*)view,PAGE_SIZE);
+			pm.zero_put(pa);
+		}
+		self->ev.wait();
+	}
+}
+
 void gc_service::thread_gc(qword arg,qword,qword,qword){
 	{
 		this_core core;
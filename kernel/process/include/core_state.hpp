@@ -6,15 +6,7 @@
 #include "intrinsics.hpp"
 
 namespace UOS{
-
-	struct core_state {
-		word uid;
-		thread* this_thread;
-		thread* fpu_owner;
-		thread* gc_ptr;
-		alignas(0x100) TSS tss;
-	};
-	static_assert(offsetof(core_state,this_thread) == 8,"core_state::this_thread mismatch");
+	class virtual_space;
 
 	class scheduler{
 	public:
@@ -28,35 +20,118 @@ namespace UOS{
 		static constexpr byte shell_priority = 5;
 		static constexpr byte user_priority = 0x0A;
 		static constexpr byte idle_priority = 0x0F;
+		//process share for fair class, 0 as fixed priority
+		static constexpr dword default_share = 0x400;
+		static constexpr dword max_share = 0x10000;
 	
 	private:
 		spin_lock lock;
+		//bit set for each non-empty priority
+		volatile word ready_mask = 0;
+		//take fair_queue & ready_queue[user_priority] in turn
+		bool fair_turn = false;
 		thread_queue ready_queue[max_priority];
+		//threads of fair share processes at user_priority
+		thread_queue fair_queue;
+		//vruntime of last picked process, never goes back
+		qword fair_floor = 0;
 
+		thread* get_fair(void);
 	public:
 		void put(thread*);
 		thread* get(byte level = max_priority);
+		//lockless, any thread above 'level'
+		inline bool ready(byte level) const{
+			return 0 != (ready_mask & ((1U << level) - 1));
+		}
 	};
 
+	struct core_state {
+		word uid;
+		//position in core_list
+		word index;
+		thread* this_thread;
+		thread* fpu_owner;
+		thread* gc_ptr;
+		//irq_entry leaves thread stack to here before switching
+		qword switch_stk;
+		qword switch_area[0x0A];
+		core_state* self;
+		qword idle_time;
+		qword busy_time;
+		SCHED_STAT stat;
+		//PCID 1..8 of this core, keyed by user_vspace::id, see this_core::irq_switch_to
+		struct{
+			qword uid;
+			qword gen;
+		} pcid_slot[8];
+		byte pcid_victim;
+		//set once interrupts enabled, see core_manager::shootdown
+		volatile bool online;
+		//pending TLB_SPACE | TLB_ALL, see core_manager::flush_tlb
+		volatile byte tlb_req;
+		//last core_manager::tlb_gen flushed on this core
+		volatile qword tlb_seen;
+		//vspace in CR3, see this_core::switch_space
+		virtual_space* volatile space;
+		alignas(0x100) TSS tss;
+		//local run queue, siblings steal from it when idle
+		alignas(0x40) scheduler ready_queue;
+	};
+	static_assert(offsetof(core_state,this_thread) == 8,"core_state::this_thread mismatch");
+	static_assert(offsetof(core_state,switch_stk) == 0x20,"core_state::switch_stk mismatch");
+
 	class core_manager{
 		dword count;
+		volatile dword active;
 		core_state** core_list;
-		qword timer_ticket;
+		//bumped by each shootdown request
+		volatile qword tlb_gen;
+		static constexpr byte TLB_SPACE = 1;
+		static constexpr byte TLB_ALL = 2;
+		static constexpr dword max_core = 0x100;
 
+		static core_state* new_core(word uid,word index,thread* th);
+		static void load_core(core_state* self);
+		void start_ap(void);
+		[[ noreturn ]]
+		static void ap_entry(qword);
 		static void on_timer(qword,void*);
+		static bool on_ipi(byte,void*);
+		static bool on_resched(byte,void*);
+		static bool on_shootdown(byte,void*);
+		static void on_slice(void);
+		static void flush_tlb(core_state* self);
 	public:
 		core_manager(void);
 		inline dword size(void) const{
-			return 1;
-			//TODO return count on SMP
+			return active;
+		}
+		//nullptr if not present
+		inline core_state const* at(dword index) const{
+			return index < count ? core_list[index] : nullptr;
+		}
+		inline dword capacity(void) const{
+			return count;
 		}
 		core_state* get(void);
+		//put into run queue of this core, wakes an idle core if this one is busy
+		void put(thread*);
+		//local first, then steal from other cores, idle thread at last
+		thread* pick(byte level = scheduler::max_priority);
 		static void preempt(bool lower);
+		//idle loop body, stops slice tick when every core is idle
+		void idle(void);
+		//flushes TLB of other online cores running 'vspace', returns when all done
+		//nullptr flushes global entries on every core as well
+		//caller invalidates its own core, never call with spin_lock held
+		void shootdown(const virtual_space* vspace = nullptr);
 	};
 
 	class this_core{
 		friend class core_manager;
 		static bool irq_switch_to(byte,void*);
+		static void switch_space(virtual_space*);
 		//void gc_step(void);
 	public:
 		this_core(void)
@@ -69,6 +144,9 @@ namespace UOS{
 		inline word id(void){
 			return read_gs<word>(offsetof(core_state,uid));
 		}
+		inline word index(void){
+			return read_gs<word>(offsetof(core_state,index));
+		}
 		inline thread* this_thread(void){
 			return reinterpret_cast<thread*>(
 				read_gs<qword>(offsetof(core_state,this_thread))
@@ -84,6 +162,14 @@ namespace UOS{
 				reinterpret_cast<qword>(th)
 			);
 		}
+		inline core_state* self(void){
+			return reinterpret_cast<core_state*>(
+				read_gs<qword>(offsetof(core_state,self))
+			);
+		}
+		inline scheduler& ready_queue(void){
+			return self()->ready_queue;
+		}
 		//locks 'th' before calling, unlocks inside
 		void switch_to(thread* th);
 	};
@@ -103,8 +189,19 @@ namespace UOS{
 		void signal(thread* = nullptr);
 	};
 
-	extern scheduler ready_queue;
+	//keeps PM zero pool topped up just above idle priority
+	class zero_service{
+		event ev;
+		thread* th_zero;
+
+		static void thread_zero(qword,qword,qword,qword);
+	public:
+		zero_service(void);
+		void signal(void);
+	};
+
 	extern core_manager cores;
 	extern gc_service gc;
+	extern zero_service zero_worker;
 }
 
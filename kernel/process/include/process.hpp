@@ -82,6 +82,8 @@ namespace UOS{
 		PRIVILEGE privilege = NORMAL;
 		dword active_count = 0;
 		const PE64* image = nullptr;
+		//backs image sections, shared with cloned processes
+		page_source* image_source = nullptr;
 		hash_set<thread, thread::hash, thread::equal> threads;
 		folder_instance* work_dir = nullptr;
 	public:
@@ -89,6 +91,12 @@ namespace UOS{
 		handle_table handles;
 		const qword start_time;
 		volatile qword cpu_time = 0;
+		//lock_add from any core
+		SCHED_STAT stat = {};
+		//weight in fair class, 0 as fixed priority
+		volatile dword share = 0;
+		//cpu time scaled by share, us
+		volatile qword vruntime = 0;
 
 		struct spawn_info{
 			file* f;
@@ -100,9 +108,19 @@ namespace UOS{
 			qword imagesize = 0;
 			qword headersize = 0;
 		};
+		struct clone_info{
+			user_vspace* vspace;
+			file* f;
+			stream* std_stream[3];
+			folder_instance* work_dir;
+			//see user_entry
+			qword args[4];
+		};
 	public:
 		process(initial_process_tag);
 		process(literal&& cmd,const spawn_info& info);
+		//memory of 'parent' shared copy-on-write, see user_vspace::clone
+		process(const process& parent,const clone_info& info);
 		~process(void);
 		OBJTYPE type(void) const override{
 			return OBJ_PROCESS;
@@ -136,6 +154,8 @@ namespace UOS{
 		folder_instance* get_work_dir(void) const;
 		bool set_work_dir(const span<char>& str);
 		thread* spawn(thread::procedure entry,const qword* args,qword stk_size = 0);
+		//initial thread for AP
+		thread* spawn_idle(void);
 		void kill(dword ret_val);
 		//on thread exit
 		void on_exit(void);
@@ -162,6 +182,8 @@ namespace UOS{
 		}
 
 		process* spawn(literal&& command,spawn_info& info);
+		//copy of calling process, single thread starting at 'entry'
+		process* clone(qword entry,qword arg);
 		void erase(process* ps);
 		bool enumerate(dword& id);
 		process* find(dword id,bool acquire);
@@ -8,6 +8,7 @@
 
 namespace UOS{
 	class process;
+	class map_view;
 	byte check_guard_page(qword);
 	class thread : public waitable{
 		struct hash{
@@ -26,11 +27,14 @@ namespace UOS{
 		};
 		//friend class waitable;
 		friend class scheduler;
+		friend class core_manager;
+		friend class this_core;
 		friend class process;
 		friend struct thread_queue;
 		friend struct hash;
 		friend struct equal;
 		friend struct conx_off_check;
+		friend class map_view;
 		friend void ::UOS::process_loader(qword,qword,qword,qword);
 		friend void ::UOS::user_entry(qword,qword,qword,qword);
 		friend byte ::UOS::check_guard_page(qword);
@@ -57,18 +61,35 @@ namespace UOS{
 		
 		context gpr;
 		SSE_context* sse = nullptr;
+		//set while some core runs on this thread's stack, see irq_entry
+		volatile bool on_core = false;
+		//eager restore credit, 2 gained per #NM, 1 spent per switch in
+		byte fpu_count = 0;
 
 		qword user_stk_top = 0;
 		qword user_stk_reserved = 0;
+		//map_view entries are not global, dropped when switched out
+		map_view* views = nullptr;
 	public:
 		qword slice_timestamp = 0;
+		//set when turning READY, for run queue wait time
+		qword ready_timestamp = 0;
 		qword user_handler = 0;
+		SCHED_STAT stat = {};
+		//last user range passed service_provider::check, stale once vspace generation moves
+		struct{
+			qword base;
+			qword top;
+			qword gen;
+			bool write;
+		} checked = {};
 		
 	private:
 		struct initial_thread_tag {};
 		static id_gen<dword> new_id;
 	public:
 		thread(initial_thread_tag, process*);
+		thread(initial_thread_tag, process*, qword stk_size);
 		thread(process* owner,procedure entry,const qword* args,qword stk_size);
 		~thread(void);
 		OBJTYPE type(void) const override{
@@ -130,6 +151,20 @@ namespace UOS{
 		void on_gc(void);
 		void save_sse(void);
 		void load_sse(void);
+		//count on this thread, its process and this core
+		void account(qword SCHED_STAT::* field,qword val = 1);
+		inline void fpu_used(void){
+			fpu_count = (fpu_count < 0x0F) ? fpu_count + 2 : 0x10;
+		}
+		//unused eager restore runs the credit out, #NM decides again
+		inline void fpu_switch(void){
+			if (fpu_count)
+				--fpu_count;
+		}
+		//restore FPU state on switch instead of #NM
+		inline bool fpu_eager(void) const{
+			return sse && fpu_count > 5;
+		}
 		void hold(void);
 		void drop(void);
 		static void sleep(qword us);
@@ -140,5 +175,6 @@ namespace UOS{
 	struct conx_off_check{
 		static_assert(offsetof(thread,gpr) == CONX_OFF,"CONX_OFF mismatch");
 		static_assert(offsetof(thread,krnl_stk_top) == KSP_OFF,"KSP_OFF mismatch");
+		static_assert(offsetof(thread,on_core) == ONCORE_OFF,"ONCORE_OFF mismatch");
 	};
 };
\ No newline at end of file
@@ -13,6 +13,8 @@ namespace UOS{
 		bool empty(void) const;
 		void put(thread*);
 		thread* get(void);
+		//'prev' precedes 'th', nullptr if 'th' is head
+		void erase(thread* th,thread* prev);
 		void clear(void);
 		static thread*& next(thread* th);
 	};
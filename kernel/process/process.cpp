@@ -53,7 +53,6 @@ dword handle_table::put(waitable* ptr){
 			auto va = vm.reserve(0,1);
 			if (va && vm.commit(va,1)){
 				page = (waitable**)va;
-				zeromemory(page,PAGE_SIZE);
 			}
 			else{
 				break;
@@ -161,6 +160,15 @@ process::process(literal&& cmd,const spawn_info& info) : \
 	work_dir(info.work_dir), commandline(move(cmd)), start_time(timer.running_time())
 {
 	IF_assert;
+	//shared time page, see basic_timer
+	{
+		auto uvs = static_cast<user_vspace*>(vspace);
+		if (TIME_PAGE_BASE != uvs->reserve(TIME_PAGE_BASE,1) \
+			|| !uvs->assign(TIME_PAGE_BASE,timer.get_page(),1))
+		{
+			bugcheck("failed to map time page for process #%d",id);
+		}
+	}
 	//image file handle as handle 0, user not accessible
 	auto res = handles.assign(0,info.f->duplicate(this));
 	assert(res);
@@ -181,6 +189,31 @@ process::process(literal&& cmd,const spawn_info& info) : \
 	th->relax();
 }
 
+process::process(const process& parent,const clone_info& info) : \
+	id(new_id()),vspace(info.vspace),privilege(parent.privilege),image(parent.image),\
+	work_dir(info.work_dir), commandline(parent.commandline), start_time(timer.running_time())
+{
+	IF_assert;
+	share = parent.share;
+	image_source = parent.image_source;
+	if (image_source)
+		image_source->acquire();
+	//image file & stream handles, other handles not inherited
+	if (info.f)
+		handles.assign(0,info.f->duplicate(this));
+	for (unsigned i = 0;i < 3;++i){
+		auto st = info.std_stream[i];
+		if (st)
+			handles.assign(i + 1,st->duplicate(this));
+	}
+#ifdef PS_TEST
+	dbgprint("cloned process $%d from $%d @ %p",id,parent.id,this);
+#endif
+	auto th = spawn(user_entry,info.args);
+	assert(th);
+	th->relax();
+}
+
 process::~process(void){
 	if (!threads.empty() || active_count){
 		bugcheck("deleting non-stop process #%d (%d,%d) @ %p",id,active_count,threads.size(),this);
@@ -190,6 +223,8 @@ process::~process(void){
 	dbgprint("deleted process $%d @ %p",id,this);
 #endif
 	delete vspace;
+	if (image_source)
+		image_source->relax();
 }
 
 thread* process::spawn(thread::procedure entry,const qword* args,qword stk_size){
@@ -207,6 +242,15 @@ thread* process::spawn(thread::procedure entry,const qword* args,qword stk_size)
 	return &*it;
 }
 
+thread* process::spawn_idle(void){
+	assert(id == 0);
+	interrupt_guard<spin_lock> guard(objlock);
+	auto it = threads.insert(thread::initial_thread_tag(),this,pe_kernel->stk_reserve);
+	it->manage();
+	++active_count;
+	return &*it;
+}
+
 void process::kill(dword ret_val){
 #ifdef PS_TEST
 	dbgprint("killing process %d @ %p",id,this);
@@ -249,6 +293,9 @@ void process::on_exit(void){
 	dbgprint("process $%d exit with %x",id,(qword)result);
 #endif
 	handles.clear();
+	//mapped files written back here in thread context, dropped with vspace
+	if (vspace != &vm)
+		static_cast<user_vspace*>(vspace)->sync();
 	if (wd)
 		wd->relax();
 }
@@ -420,6 +467,49 @@ process* process_manager::spawn(literal&& command,spawn_info& info){
 	return nullptr;
 }
 
+process* process_manager::clone(qword entry,qword arg){
+	this_core core;
+	auto this_process = core.this_thread()->get_process();
+	assert(this_process->vspace != &vm);
+
+	auto vs = static_cast<user_vspace*>(this_process->vspace)->clone();
+	if (vs == nullptr)
+		return nullptr;
+	//user stack for initial thread, see service_provider::create_thread
+	qword stk_size = this_process->get_stack_preserve();
+	auto count = max<dword>(1,align_up(stk_size,PAGE_SIZE)/PAGE_SIZE);
+	auto stk_base = vs->reserve(0,count + 1);
+	if (stk_base == 0 || !vs->commit(stk_base + count*PAGE_SIZE,1)){
+		delete vs;
+		return nullptr;
+	}
+	process::clone_info ps_info = {
+		vs,
+		nullptr,
+		{nullptr,nullptr,nullptr},
+		this_process->get_work_dir(),
+		{entry,arg,stk_base + (count + 1)*PAGE_SIZE,stk_size}
+	};
+	//handles kept alive by shared lock
+	lock_guard<handle_table> handle_guard(this_process->handles);
+	auto obj = this_process->handles[0];
+	if (obj && obj->type() == OBJ_FILE)
+		ps_info.f = static_cast<file*>(obj);
+	for (unsigned i = 0;i < 3;++i){
+		obj = this_process->handles[i + 1];
+		if (obj == nullptr)
+			continue;
+		auto type = obj->type();
+		if (type == OBJ_STREAM || type == OBJ_PIPE || type == OBJ_FILE)
+			ps_info.std_stream[i] = static_cast<stream*>(obj);
+	}
+
+	interrupt_guard<spin_lock> guard(lock);
+	auto it = table.insert(*this_process,ps_info);
+	it->manage();
+	return &*it;
+}
+
 void process_manager::erase(process* ps){
 	interrupt_guard<spin_lock> guard(lock);
 	auto it = table.find(ps->id);
@@ -13,24 +13,37 @@ using namespace UOS;
 
 id_gen<dword> thread::new_id;
 
+//guard page on both side, fully committed
+//#PF runs on this stack, overflow ends in #DF
+static qword new_krnl_stk(qword reserved){
+	auto va = vm.reserve(0,2 + reserved/PAGE_SIZE);
+	if (!va)
+		bugcheck("vm.reserve failed with 0x%x pages",reserved);
+	auto top = va + PAGE_SIZE + reserved;
+	auto res = vm.commit(va + PAGE_SIZE,reserved/PAGE_SIZE);
+	if (!res)
+		bugcheck("vm.commit failed @ %p",va + PAGE_SIZE);
+	return top;
+}
+
 //initial thread
-thread::thread(initial_thread_tag, process* p) : id(new_id()), state(RUNNING), critical(0), priority(scheduler::kernel_priority), slice(scheduler::max_slice), ps(p) {
+thread::thread(initial_thread_tag, process* p) : id(new_id()), state(RUNNING), critical(0), priority(scheduler::kernel_priority), slice(scheduler::max_slice), ps(p), on_core(true) {
 	assert(ps && id == 0);
 	krnl_stk_top = 0;	//???
 	krnl_stk_reserved = pe_kernel->stk_reserve;
 }
 
+//initial thread of AP, running as idle thread
+thread::thread(initial_thread_tag, process* p, qword stk_size) : id(new_id()), state(RUNNING), critical(0), priority(scheduler::idle_priority), slice(scheduler::max_slice), ps(p), krnl_stk_reserved(align_down(stk_size,PAGE_SIZE)), on_core(true) {
+	assert(ps && krnl_stk_reserved >= PAGE_SIZE);
+	krnl_stk_top = new_krnl_stk(krnl_stk_reserved);
+}
+
 thread::thread(process* p, procedure entry, const qword* args, qword stk_size) : id(new_id()), state(READY), critical(0), priority(this_core().this_thread()->get_priority()), slice(scheduler::max_slice), ps(p), krnl_stk_reserved(align_down(stk_size,PAGE_SIZE)) {
 	IF_assert;
 	assert(ps && krnl_stk_reserved >= PAGE_SIZE);
 	lock_guard<spin_lock> guard(objlock);
-	auto va = vm.reserve(0,2 + krnl_stk_reserved/PAGE_SIZE);
-	if (!va)
-		bugcheck("vm.reserve failed with 0x%x pages",krnl_stk_reserved);
-	krnl_stk_top = va + PAGE_SIZE + krnl_stk_reserved;
-	auto res = vm.commit(krnl_stk_top - PAGE_SIZE,1);
-	if (!res)
-		bugcheck("vm.commit failed @ %p",krnl_stk_top - PAGE_SIZE);
+	krnl_stk_top = new_krnl_stk(krnl_stk_reserved);
 	gpr.rbp = krnl_stk_top;
 	gpr.rsp = krnl_stk_top - 0x30;
 	gpr.ss = SEG_KRNL_SS;
@@ -44,7 +57,8 @@ thread::thread(process* p, procedure entry, const qword* args, qword stk_size) :
 #ifdef PS_TEST
 	dbgprint("new thread $%d @ %p",id,this);
 #endif
-	ready_queue.put(this);
+	ready_timestamp = timer.running_time();
+	cores.put(this);
 
 }
 
@@ -62,8 +76,8 @@ thread::~thread(void){
 		if (core.fpu_owner() == this){
 			core.fpu_owner(nullptr);
 		}
-		//TODO remove FPU context from all processor core
-		delete sse;
+		//on SMP, FPU state saved when switching out
+		fpu.release(sse);
 	}
 	if (user_stk_top){
 		// if (!get_process()->vspace->release(user_stk_top - user_stk_reserved - PAGE_SIZE,1 + user_stk_reserved/PAGE_SIZE))
@@ -99,6 +113,7 @@ bool thread::set_state(thread::STATE st, qword arg, waitable* obj){
 	}
 	switch(st){
 	case READY:
+		ready_timestamp = timer.running_time();
 		if (state == WAITING){
 			//arg as reason
 			switch(arg){
@@ -191,21 +206,24 @@ void thread::on_gc(void){
 	relax();
 }
 
+void thread::account(qword SCHED_STAT::* field,qword val){
+	IF_assert;
+	stat.*field += val;
+	lock_add(&(ps->stat.*field),val);
+	this_core core;
+	core.self()->stat.*field += val;
+}
+
 void thread::save_sse(void){
 	if (!sse){
-		sse = new SSE_context;
+		sse = fpu.allocate();
 	}
-	assert((qword)sse == align_down((qword)sse, sizeof(sse)));
-	fxsave(sse);
+	fpu.save(sse);
 }
 
 void thread::load_sse(void){
-	if (sse){
-		fxrstor(sse);
-	}
-	else{
-		fpu_init();
-	}
+	//init state if never saved
+	fpu.load(sse);
 }
 
 void thread::hold(void){
@@ -244,7 +262,7 @@ void thread::sleep(qword us){
 	thread* next_thread;
 	bool need_gc = false;
 	do{
-		next_thread = ready_queue.get();
+		next_thread = cores.pick();
 		if (!next_thread)
 			bugcheck("no ready thread");
 		next_thread->lock();
@@ -49,6 +49,17 @@ thread* thread_queue::get(void){
 	}
 }
 
+void thread_queue::erase(thread* th,thread* prev){
+	assert(th && (prev ? prev->next : head) == th);
+	if (prev)
+		prev->next = th->next;
+	else
+		head = th->next;
+	if (tail == th)
+		tail = prev;
+	th->next = nullptr;
+}
+
 thread*& thread_queue::next(thread* th){
 	return th->next;
 }
@@ -95,7 +106,7 @@ REASON waitable::imp_wait(qword us){
 	thread* put_back = nullptr;
 	bool need_gc = false;
 	do{
-		next_thread = ready_queue.get();
+		next_thread = cores.pick();
 		if (!next_thread)
 			bugcheck("no ready thread");
 		if (next_thread == this){
@@ -127,7 +138,7 @@ REASON waitable::imp_wait(qword us){
 	}
 	this_thread->unlock();
 	if (put_back)
-		ready_queue.put(put_back);
+		cores.put(put_back);
 	objlock.unlock();
 	core.switch_to(next_thread);
 	return this_thread->get_reason();
@@ -160,13 +171,13 @@ void waitable::on_timer(qword ticket,void* ptr){
 		this_thread->lock();
 		if (this_thread->set_state(thread::READY)){
 			this_thread->put_slice(scheduler::max_slice);
-			ready_queue.put(this_thread);
+			cores.put(this_thread);
 		}
 		this_thread->unlock();
 		core.switch_to(th);
 	}
 	else{
-		ready_queue.put(th);
+		cores.put(th);
 		th->unlock();
 	}
 }
@@ -212,7 +223,7 @@ size_t waitable::imp_notify(thread* th,REASON reason){
 		auto next = thread_queue::next(th);
 		th->lock();
 		if (th->set_state(thread::READY,reason)){
-			ready_queue.put(th);
+			cores.put(th);
 			th->unlock();
 			++count;
 		}
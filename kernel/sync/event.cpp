@@ -12,13 +12,14 @@ event::~event(void){
 }
 
 REASON event::wait(qword us,wait_callback func){
-	if (state){
-		if (func){
-			func();
-		}
+	//state checked under objlock, signal_all cannot slip in before imp_wait
+	interrupt_guard<spin_lock> guard(objlock);
+	if (func)
+		func();
+	if (state)
 		return PASSED;
-	}
-	return waitable::wait(us,func);
+	guard.drop();
+	return imp_wait(us);
 }
 
 bool event::signal_one(void){
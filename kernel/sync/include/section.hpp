@@ -0,0 +1,54 @@
+#pragma once
+#include "types.h"
+#include "process/include/waitable.hpp"
+#include "memory/include/vm.hpp"
+
+namespace UOS{
+	//zeroed frames mapped into several vspaces, writes seen by all of them
+	//see user_vspace::map_source & user_vspace::fault_in
+	class section : public waitable{
+		//frames of section, outlives it while any vspace maps it
+		class source : public page_source{
+			const dword count;
+			qword* const frames;
+		public:
+			//capacity reserved by caller
+			source(dword page_count);
+			~source(void);
+			inline dword size(void) const{
+				return count;
+			}
+			bool fill(qword offset,void* page,dword length) override;
+			//frames owned by source, no reference per mapping
+			qword share(qword offset,dword length) override;
+			void unshare(qword offset,qword pa) override;
+			bool writable(void) const override{
+				return true;
+			}
+		};
+		source* const frames;
+		bool named = false;
+
+		section(source* src) : frames(src) {}
+	public:
+		static constexpr dword max_count = 0x4000;
+		//nullptr if out of memory
+		static section* create(dword page_count);
+		~section(void);
+		OBJTYPE type(void) const override{
+			return OBJ_SECTION;
+		}
+		//nothing to wait for
+		bool check(void) override{
+			return true;
+		}
+		inline dword size(void) const{
+			return frames->size();
+		}
+		//maps first 'page_count' pages writable at 'va', reserved if 0
+		//returns mapped address, 0 on failure
+		qword map(user_vspace& vspace,qword va,dword page_count);
+		bool relax(void) override;
+		void manage(void*) override;
+	};
+}
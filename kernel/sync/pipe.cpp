@@ -2,6 +2,8 @@
 #include "process/include/process.hpp"
 #include "lock_guard.hpp"
 #include "interface/include/object.hpp"
+#include "memory/include/vm.hpp"
+#include "util.hpp"
 
 using namespace UOS;
 
@@ -57,6 +59,16 @@ inline bool pipe::is_empty(void) const{
 	return head == tail;
 }
 
+//user buffer accessed directly, caller in its own address space
+static inline dword transfer(void* dst,const void* sor,dword length){
+	if (!IS_HIGHADDR(dst))
+		return copy_to_user(dst,sor,length);
+	if (!IS_HIGHADDR(sor))
+		return copy_from_user(dst,sor,length);
+	memcpy(dst,sor,length);
+	return length;
+}
+
 inline bool pipe::check(void){
 	bool is_owner_write = (mode & owner_write);
 	if (is_owner() == is_owner_write)	//is_full
@@ -89,12 +101,18 @@ dword pipe::read(void* dst,dword length){
 	dword count = 0;
 	//interrupt_guard<spin_lock> guard(objlock);
 	bool need_notify = is_full();
-	while(count < length){
-		if (is_empty())
-			break;
-		((byte*)dst)[count++] = buffer[head++];
+	while(count < length && !is_empty()){
+		//contiguous part of ring
+		dword len = min(length - count,(tail > head ? tail : limit) - head);
+		auto res = transfer((byte*)dst + count,buffer + head,len);
+		count += res;
+		head += res;
 		if (head == limit)
 			head = 0;
+		if (res != len){
+			iostate |= MEM_FAILURE;
+			break;
+		}
 	}
 	if (count && need_notify){
 		guard.drop();
@@ -120,14 +138,20 @@ dword pipe::write(void const* sor,dword length){
 			return 0;
 	}
 	bool need_notify = is_empty();
-	while(count < length){
-		if (is_full())
-			break;
-		buffer[tail++] = ((byte const*)sor)[count++];
+	while(count < length && !is_full()){
+		//one slot kept empty
+		dword len = min(length - count,(head > tail ? head - 1 : (head ? limit : limit - 1)) - tail);
+		auto res = transfer(buffer + tail,(byte const*)sor + count,len);
+		count += res;
+		tail += res;
 		if (tail == limit)
 			tail = 0;
+		if (res != len){
+			iostate |= MEM_FAILURE;
+			break;
+		}
 	}
-	assert(0 == (mode & atomic_write) || count == length);
+	assert(0 == (mode & atomic_write) || count == length || (iostate & MEM_FAILURE));
 
 	if (count && need_notify){
 		guard.drop();
@@ -0,0 +1,97 @@
+#include "section.hpp"
+#include "lock_guard.hpp"
+#include "interface/include/object.hpp"
+#include "memory/include/pm.hpp"
+#include "assert.hpp"
+#include "util.hpp"
+
+using namespace UOS;
+
+section::source::source(dword page_count) : count(page_count), \
+	frames((qword*)operator new(sizeof(qword)*page_count)) {
+		assert(page_count);
+		auto res = pm.allocate_batch(count,frames,PM::TAKE,true);
+		if (res != count)
+			bugcheck("section: allocate_batch failed (%x,%x)",res,count);
+	}
+
+section::source::~source(void){
+	for (dword i = 0;i < count;++i)
+		pm.release(frames[i]);
+	operator delete(frames,sizeof(qword)*count);
+}
+
+bool section::source::fill(qword offset,void* page,dword length){
+	auto index = offset >> 12;
+	if ((offset & PAGE_MASK) || index >= count || length > PAGE_SIZE)
+		return false;
+	map_view view(frames[index]);
+	memcpy(page,(const void*)view,length);
+	return true;
+}
+
+qword section::source::share(qword offset,dword){
+	auto index = offset >> 12;
+	if ((offset & PAGE_MASK) || index >= count)
+		return 0;
+	return frames[index];
+}
+
+void section::source::unshare(qword offset,qword pa){
+	assert(0 == (offset & PAGE_MASK) && (offset >> 12) < count);
+	assert(frames[offset >> 12] == pa);
+}
+
+section* section::create(dword page_count){
+	if (page_count == 0 || page_count > max_count)
+		return nullptr;
+	if (!pm.reserve(page_count))
+		return nullptr;
+	return new section(new source(page_count));
+}
+
+section::~section(void){
+	frames->relax();
+	objlock.lock();
+	notify(ABANDON);
+}
+
+qword section::map(user_vspace& vspace,qword va,dword page_count){
+	if (page_count == 0 || page_count > size())
+		return 0;
+	bool reserved = false;
+	if (va == 0){
+		va = vspace.reserve(0,page_count);
+		if (!va)
+			return 0;
+		reserved = true;
+	}
+	//source acquired by vspace, frames kept until the mapping released
+	if (vspace.map_source(va,page_count,frames,0,(qword)page_count*PAGE_SIZE))
+		return va;
+	if (reserved)
+		vspace.release(va,page_count);
+	return 0;
+}
+
+bool section::relax(void){
+	interrupt_guard<void> ig;
+	auto res = waitable::relax();
+	if (!res){
+		if (named)
+			named_obj.erase(this);
+		delete this;
+	}
+	return res;
+}
+
+void section::manage(void* ptr){
+	interrupt_guard<void> ig;
+	if (ptr){
+		if (get_reference_count() == 0)
+			bugcheck("expose non-managed section @ %p",this);
+		named = true;
+	}
+	else
+		waitable::manage();
+}
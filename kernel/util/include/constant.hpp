@@ -42,6 +42,7 @@
 #define PT_MAP_PBASE ((qword)0x9000)
 #define DIRECT_MAP_TOP ((qword)0xA000)
 #define BOOT_AREA_TOP ((qword)0x10000)
+#define AP_ENTRY_PBASE ((qword)0xF000)
 
 #define HPET_VBASE HIGHADDR(0xE000)
 #define LOCAL_APIC_VBASE HIGHADDR(0xD000)
@@ -55,8 +56,15 @@
 #define PMMBMP_BASE HIGHADDR(0x00400000)
 #define PMMBMP_PT_PBASE (DIRECT_MAP_TOP)
 
+//PL4 slot of user vspace pointing to itself, tables of current lower half seen as arrays
+#define PT_WINDOW_INDEX ((qword)0x1FE)
+#define PT_WINDOW_BASE ((qword)0xFFFFFF0000000000ULL)
+#define PDT_WINDOW_BASE (PT_WINDOW_BASE | (PT_WINDOW_INDEX << 30))
+#define PDPT_WINDOW_BASE (PDT_WINDOW_BASE | (PT_WINDOW_INDEX << 21))
+
 #define PAGE_XD ((qword)1 << 63)
 #define PAGE_GLOBAL ((qword)0x100)
+#define PAGE_DIRTY ((qword)0x40)
 #define PAGE_CD ((qword)0x10)
 #define PAGE_WT ((qword)0x08)
 #define PAGE_USER ((qword)0x04)
@@ -107,6 +107,13 @@ namespace UOS{
 			"hlt"
 		);
 	}
+	//no interrupt can slip in between
+	inline void sti_hlt(void){
+		ASM (
+			"sti\n\t"
+			"hlt"
+		);
+	}
 	inline void invlpg(void* ptr){
 		ASM (
 			"invlpg %0"
@@ -146,6 +153,42 @@ namespace UOS{
 		);
 	}
 
+	//area size given by CPUID, not sizeof(SSE_context)
+	inline void xsave(SSE_context* ptr,qword mask){
+		ASM (
+			"XSAVE64 [%0]"
+			:
+			: "r" (ptr), "a" ((dword)mask), "d" ((dword)(mask >> 32))
+			: "memory"
+		);
+	}
+
+	inline void xsaveopt(SSE_context* ptr,qword mask){
+		ASM (
+			"XSAVEOPT64 [%0]"
+			:
+			: "r" (ptr), "a" ((dword)mask), "d" ((dword)(mask >> 32))
+			: "memory"
+		);
+	}
+
+	inline void xrstor(const SSE_context* ptr,qword mask){
+		ASM (
+			"XRSTOR64 [%0]"
+			:
+			: "r" (ptr), "a" ((dword)mask), "d" ((dword)(mask >> 32))
+			: "memory"
+		);
+	}
+
+	inline void xsetbv(dword index,qword data){
+		ASM (
+			"xsetbv"
+			:
+			: "c" (index), "a" ((dword)data), "d" ((dword)(data >> 32))
+		);
+	}
+
 	inline void swapgs(void){
 		ASM (
 			"swapgs"
@@ -160,6 +203,43 @@ namespace UOS{
 		);
 	}
 
+	inline void cpuid(dword leaf,dword subleaf,dword* res){
+		ASM (
+			"cpuid"
+			: "=a" (res[0]), "=b" (res[1]), "=c" (res[2]), "=d" (res[3])
+			: "a" (leaf), "c" (subleaf)
+		);
+	}
+
+	//data should not be zero
+	inline dword bsf(dword data){
+		dword index;
+		ASM (
+			"bsf %0,%1"
+			: "=r" (index)
+			: "rm" (data)
+		);
+		return index;
+	}
+	inline qword bsf(qword data){
+		qword index;
+		ASM (
+			"bsf %0,%1"
+			: "=r" (index)
+			: "rm" (data)
+		);
+		return index;
+	}
+	inline qword bsr(qword data){
+		qword index;
+		ASM (
+			"bsr %0,%1"
+			: "=r" (index)
+			: "rm" (data)
+		);
+		return index;
+	}
+
 	inline void mm_pause(void){
 		ASM (
 			"pause"
@@ -200,6 +280,23 @@ namespace UOS{
 		);
 	}
 
+	inline qword read_cr4(void){
+		qword data;
+		ASM (
+			"mov %0,cr4"
+			: "=r" (data)
+		);
+		return data;
+	}
+
+	inline void write_cr4(qword data){
+		ASM (
+			"mov cr4,%0"
+			:
+			: "r" (data)
+		);
+	}
+
 	inline qword read_cr2(void){
 		qword data;
 		ASM (
@@ -301,6 +398,14 @@ namespace UOS{
 			: "ri" (val)
 		);
 	}
+	template<typename T>
+	inline void lock_and(T volatile* dst,T val){
+		ASM (
+			"lock and %0, %1"
+			: "+m" (*dst)
+			: "ri" (val)
+		);
+	}
 
 	inline void* return_address(void){
 		return __builtin_return_address(0);
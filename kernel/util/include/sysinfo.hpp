@@ -6,7 +6,7 @@ namespace UOS{
 	class system_feature{
 		qword state = 0;	
 	public:
-		enum FEATURE : word {GDB, MEM, APIC, PS, SCR};
+		enum FEATURE : word {GDB, MEM, APIC, PS, SCR, PCID};
 		void set(FEATURE);
 		void clear(FEATURE);
 		bool get(FEATURE) const;